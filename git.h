@@ -46,10 +46,17 @@
 #define GIT_DIFF_BLAME_NO_PARENT(encoding_arg, context_arg, space_arg, new_name) \
 	GIT_DIFF_INITIAL(encoding_arg, "", context_arg, space_arg, "/dev/null", new_name)
 
+/* One line per commit with fields separated by 0x1f: the boundary mark
+ * followed by the commit and parent IDs, the author, the author date as
+ * seconds and in ISO format (for the time zone), the reflog selector and
+ * message, and finally the subject. */
+#define GIT_MAIN_LOG_FORMAT \
+	"--pretty=tformat:%m%H %P%x1f%an <%ae>%x1f%at%x1f%ai%x1f%gD%x1f%gs%x1f%s"
+
 #define GIT_MAIN_LOG(encoding_arg, diffargs, revargs, fileargs) \
 	"git", "log", (encoding_arg), \
 		opt_commit_order_arg, (diffargs), (revargs), \
-		"--no-color", "--pretty=raw", "--parents", \
+		"--no-color", GIT_MAIN_LOG_FORMAT, "--parents", \
 		"--", (fileargs), NULL
 
 /* FIXME(jfonseca): This is incomplete, but enough to support:
@@ -143,13 +143,35 @@ graph_reorder_parents(struct graph *graph)
 	}
 }
 
+static size_t
+graph_canvas_width(struct graph *graph)
+{
+	size_t max_width = graph->max_width;
+
+	/* Leave room for at least one column before the overflow marker. */
+	if (max_width && max_width < 2)
+		max_width = 2;
+	if (max_width && graph->row.size > max_width)
+		return max_width;
+	return graph->row.size;
+}
+
 static void
 graph_canvas_append_symbol(struct graph *graph, struct graph_symbol *symbol)
 {
 	struct graph_canvas *canvas = graph->canvas;
 
-	if (realloc_graph_symbols(&canvas->symbols, canvas->size, 1))
+	if (canvas->size < graph_canvas_width(graph)) {
 		canvas->symbols[canvas->size++] = *symbol;
+
+	} else if (canvas->size) {
+		/* Fold the remaining columns into the last one, keeping
+		 * track of whether the commit was among them. */
+		struct graph_symbol *last = &canvas->symbols[canvas->size - 1];
+
+		last->overflow = 1;
+		last->commit |= symbol->commit;
+	}
 }
 
 static bool
@@ -164,6 +186,10 @@ graph_insert_parents(struct graph *graph)
 
 	assert(!graph_needs_expansion(graph));
 
+	if (!realloc_graph_symbols(&graph->canvas->symbols, graph->canvas->size,
+				   graph_canvas_width(graph)))
+		return FALSE;
+
 	for (pos = 0; pos < graph->position; pos++) {
 		struct graph_column *column = &row->columns[pos];
 		struct graph_symbol symbol = column->symbol;
@@ -251,7 +277,8 @@ graph_render_parents(struct graph *graph)
 	if (!graph_expand(graph))
 		return FALSE;
 	graph_reorder_parents(graph);
-	graph_insert_parents(graph);
+	if (!graph_insert_parents(graph))
+		return FALSE;
 	if (!graph_collapse(graph))
 		return FALSE;
 
@@ -284,6 +311,9 @@ graph_add_commit(struct graph *graph, struct graph_canvas *canvas,
 const char *
 graph_symbol_to_utf8(struct graph_symbol *symbol)
 {
+	if (symbol->overflow)
+		return symbol->commit ? "…●" : " …";
+
 	if (symbol->commit) {
 		if (symbol->boundary)
 			return " ◯";
@@ -325,6 +355,12 @@ graph_symbol_to_chtype(struct graph_symbol *symbol)
 {
 	static chtype graphics[2];
 
+	if (symbol->overflow) {
+		graphics[0] = symbol->commit ? ACS_RARROW : ' ';
+		graphics[1] = symbol->commit ? 'o' : ACS_RARROW;
+		return graphics;
+	}
+
 	if (symbol->commit) {
 		graphics[0] = ' ';
 		if (symbol->boundary)
@@ -374,6 +410,9 @@ graph_symbol_to_chtype(struct graph_symbol *symbol)
 const char *
 graph_symbol_to_ascii(struct graph_symbol *symbol)
 {
+	if (symbol->overflow)
+		return symbol->commit ? "~*" : " ~";
+
 	if (symbol->commit) {
 		if (symbol->boundary)
 			return " o";
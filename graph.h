@@ -29,6 +29,8 @@ struct graph_symbol {
 
 	unsigned int vbranch:1;
 	unsigned int branched:1;
+
+	unsigned int overflow:1;
 };
 
 struct graph_canvas {
@@ -54,6 +56,7 @@ struct graph {
 	const char *id;
 	struct graph_canvas *canvas;
 	size_t colors[GRAPH_COLORS];
+	size_t max_width;		/* Fold columns beyond this width, if set. */
 	bool has_parents;
 	bool is_boundary;
 };
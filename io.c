@@ -546,6 +546,8 @@ io_read(struct io *io, void *buf, size_t bufsize)
 
 DEFINE_ALLOCATOR(io_realloc_buf, char, BUFSIZ)
 
+#define IO_BUFSIZE	(BUFSIZ * 8)
+
 char *
 io_get(struct io *io, int c, bool can_read)
 {
@@ -581,9 +583,13 @@ io_get(struct io *io, int c, bool can_read)
 			memmove(io->buf, io->bufpos, io->bufsize);
 
 		if (io->bufalloc == io->bufsize) {
-			if (!io_realloc_buf(&io->buf, io->bufalloc, BUFSIZ))
+			/* Start with a large buffer so big outputs are read
+			 * using few system calls. */
+			size_t increase = io->bufalloc ? BUFSIZ : IO_BUFSIZE;
+
+			if (!io_realloc_buf(&io->buf, io->bufalloc, increase))
 				return NULL;
-			io->bufalloc += BUFSIZ;
+			io->bufalloc += increase;
 		}
 
 		io->bufpos = io->buf;
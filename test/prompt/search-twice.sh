@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# Type two searches in a row and check that the second one selects the
+# line matching what was typed. The input buffer is reused by each prompt,
+# so text left over from the first search must not leak into the second.
+#
+# Runs tig in a terminal using script(1) and records the selected commit
+# with a run request which exits tig.
+
+tig="$(cd "$(dirname "$0")/../.." && pwd)/tig"
+tmp="$(mktemp -d)"
+trap 'rm -rf "$tmp"' EXIT
+
+if ! command -v script >/dev/null; then
+	echo "script(1) is not available, skipping"
+	exit 0
+fi
+
+# Commit IDs are matched too, so keep them fixed and search for letters
+# which are not hex digits. With the text of the first search left in the
+# buffer, typing "xy" searches for "xelloy" while the prompt is open.
+export GIT_AUTHOR_NAME=Test GIT_AUTHOR_EMAIL=test@test
+export GIT_COMMITTER_NAME=Test GIT_COMMITTER_EMAIL=test@test
+export GIT_AUTHOR_DATE="2013-01-01 00:00:00 +0000"
+export GIT_COMMITTER_DATE="$GIT_AUTHOR_DATE"
+
+git init -q "$tmp/repo" || exit 1
+cd "$tmp/repo" || exit 1
+for subject in xelloy "xy here" hello top; do
+	git commit -q --allow-empty -m "$subject" || exit 1
+done
+
+printf 'bind main X @<git tag selected %%(commit)\n' > "$tmp/tigrc"
+
+(sleep 1; printf '/hello\r'; sleep 0.5; printf '/xy\r'; sleep 0.5; printf 'X'; sleep 2) |
+	TERM=xterm TIGRC_USER="$tmp/tigrc" script -qec "$tig" /dev/null >/dev/null
+
+selected="$(git log -1 --format=%s selected 2>/dev/null)"
+if test "$selected" != "xy here"; then
+	echo "expected 'xy here' to be selected, got '$selected'"
+	exit 1
+fi
@@ -78,10 +78,23 @@ static inline int timecmp(const struct time *t1, const struct time *t2)
 	return t1->sec - t2->sec;
 }
 
+/* Formatted dates are cached since the same dates are formatted each time
+ * lines are drawn or searched. Relative dates depend on the current time
+ * and are always formatted. */
+#define DATE_CACHE_SIZE	1024
+
+struct date_cache_entry {
+	struct time time;
+	enum date date;
+	char buf[DATE_WIDTH + 1];
+};
+
 static const char *
 mkdate(const struct time *time, enum date date)
 {
+	static struct date_cache_entry date_cache[DATE_CACHE_SIZE];
 	static char buf[DATE_WIDTH + 1];
+	struct date_cache_entry *entry;
 	static const struct enum_map_entry reldate[] = {
 		{ "second", 1,			60 * 2 },
 		{ "minute", 60,			60 * 60 * 2 },
@@ -96,6 +109,11 @@ mkdate(const struct time *time, enum date date)
 	if (!date || !time || !time->sec)
 		return "";
 
+	entry = &date_cache[((unsigned long) time->sec ^ date) % DATE_CACHE_SIZE];
+	if (date != DATE_RELATIVE && entry->date == date &&
+	    entry->time.sec == time->sec && entry->time.tz == time->tz)
+		return entry->buf;
+
 	if (date == DATE_RELATIVE) {
 		struct timeval now;
 		time_t date = time->sec + time->tz;
@@ -125,7 +143,15 @@ mkdate(const struct time *time, enum date date)
 	else {
 		gmtime_r(&time->sec, &tm);
 	}
-	return strftime(buf, sizeof(buf), DATE_FORMAT, &tm) ? buf : NULL;
+
+	if (!strftime(entry->buf, sizeof(entry->buf), DATE_FORMAT, &tm)) {
+		entry->date = DATE_NO;
+		return NULL;
+	}
+
+	entry->time = *time;
+	entry->date = date;
+	return entry->buf;
 }
 
 #define FILE_SIZE_ENUM(_) \
@@ -181,9 +207,11 @@ DEFINE_ENUM(author, AUTHOR_ENUM);
 struct ident {
 	const char *name;
 	const char *email;
+	const char *initials;	/* Abbreviated name, set when interned. */
+	const char *email_user;	/* User part of the email, set when interned. */
 };
 
-static const struct ident unknown_ident = { "Unknown", "unknown@localhost" };
+static struct ident unknown_ident = { "Unknown", "unknown@localhost", "Unknown", "unknown" };
 
 static inline int
 ident_compare(const struct ident *i1, const struct ident *i2)
@@ -262,9 +290,9 @@ mkauthor(const struct ident *ident, int cols, enum author author)
 	if (author == AUTHOR_EMAIL && ident->email)
 		return ident->email;
 	if (author == AUTHOR_EMAIL_USER && ident->email)
-		return get_email_user(ident->email);
+		return ident->email_user;
 	if (abbreviate && ident->name)
-		return get_author_initials(ident->name);
+		return ident->initials;
 	return ident->name;
 }
 
@@ -351,6 +379,7 @@ DEFINE_ENUM(commit_order, COMMIT_ORDER_ENUM);
 	REQ_(STAGE_UPDATE_LINE,	"Update single line"), \
 	REQ_(STAGE_NEXT,	"Find next chunk to stage"), \
 	REQ_(STAGE_SPLIT_CHUNK,	"Split the current chunk"), \
+	REQ_(STAGE_QUEUE,	"Queue line or chunk for update"), \
 	REQ_(DIFF_CONTEXT_DOWN,	"Decrease the diff context"), \
 	REQ_(DIFF_CONTEXT_UP,	"Increase the diff context"), \
 	\
@@ -469,6 +498,7 @@ static enum author opt_author		= AUTHOR_FULL;
 static enum filename opt_filename	= FILENAME_AUTO;
 static enum file_size opt_file_size	= FILE_SIZE_DEFAULT;
 static bool opt_rev_graph		= TRUE;
+static int opt_rev_graph_width		= 0;
 static bool opt_line_number		= FALSE;
 static bool opt_show_refs		= TRUE;
 static bool opt_show_changes		= TRUE;
@@ -523,6 +553,9 @@ static char opt_env_columns[64]		= "";
 static char *opt_env[]			= { opt_env_lines, opt_env_columns, NULL };
 static bool opt_mouse			= FALSE;
 static int opt_scroll_wheel_lines	= 3;
+static int opt_main_view_page_size	= 0;
+static int opt_diff_view_page_size	= 0;
+static bool opt_main_view_cache		= FALSE;
 
 #define is_initial_commit()	(!get_ref_head())
 #define is_head_commit(rev)	(!strcmp((rev), "HEAD") || (get_ref_head() && !strncmp(rev, get_ref_head()->id, SIZEOF_REV - 1)))
@@ -644,6 +677,7 @@ LINE(TESTED,	   "    Tested-by",	COLOR_YELLOW,	COLOR_DEFAULT,	0), \
 LINE(REVIEWED,	   "    Reviewed-by",	COLOR_YELLOW,	COLOR_DEFAULT,	0), \
 LINE(DEFAULT,	   "",			COLOR_DEFAULT,	COLOR_DEFAULT,	A_NORMAL), \
 LINE(CURSOR,	   "",			COLOR_WHITE,	COLOR_GREEN,	A_BOLD), \
+LINE(SEARCH_RESULT, "",			COLOR_BLACK,	COLOR_YELLOW,	0), \
 LINE(STATUS,	   "",			COLOR_GREEN,	COLOR_DEFAULT,	0), \
 LINE(DELIMITER,	   "",			COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
 LINE(DATE,         "",			COLOR_BLUE,	COLOR_DEFAULT,	0), \
@@ -673,6 +707,7 @@ LINE(STAT_NONE,    "",			COLOR_DEFAULT,	COLOR_DEFAULT,	0), \
 LINE(STAT_STAGED,  "",			COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
 LINE(STAT_UNSTAGED,"",			COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
 LINE(STAT_UNTRACKED,"",			COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
+LINE(STAT_QUEUED,  "",			COLOR_BLACK,	COLOR_CYAN,	0), \
 LINE(HELP_KEYMAP,  "",			COLOR_CYAN,	COLOR_DEFAULT,	0), \
 LINE(HELP_GROUP,   "",			COLOR_BLUE,	COLOR_DEFAULT,	0), \
 LINE(DIFF_STAT,		"",	  	COLOR_BLUE,	COLOR_DEFAULT,	0), \
@@ -724,25 +759,134 @@ DEFINE_ALLOCATOR(realloc_color_pair, struct line_info *, 8)
 /* Color IDs must be 1 or higher. [GH #15] */
 #define COLOR_ID(line_type)		((line_type) + 1)
 
+/*
+ * Lines are classified using a trie of the line prefixes to match, indexed
+ * by the first byte of the line. Each node records the first rule, in the
+ * order of the custom colors followed by line_info, ending at the node so
+ * the first matching rule wins like when trying each rule in turn.
+ */
+
+struct line_rule_node {
+	int child;		/* First node for the next byte or 0. */
+	int next;		/* Sibling node for another byte or 0. */
+	int rule;		/* Rule ending at this node or -1. */
+	unsigned char c;	/* Lower case byte to match. */
+};
+
+static struct line_rule_node *line_rule_node;
+static size_t line_rule_nodes;
+static int line_rule_first[256];
+static int line_rule_empty;
+static bool line_rules_compiled;
+
+DEFINE_ALLOCATOR(realloc_line_rule_node, struct line_rule_node, 64)
+
+static int
+add_line_rule_node(int next, unsigned char c)
+{
+	struct line_rule_node *node;
+
+	if (!realloc_line_rule_node(&line_rule_node, line_rule_nodes, 1))
+		die("Failed to alloc line rules");
+
+	node = &line_rule_node[line_rule_nodes];
+	node->child = 0;
+	node->next = next;
+	node->rule = -1;
+	node->c = c;
+	return line_rule_nodes++;
+}
+
+static void
+add_line_rule(const char *line, int linelen, int rule)
+{
+	int parent = 0;
+	int node = line_rule_first[tolower((unsigned char) line[0])];
+	int pos;
+
+	for (pos = 0; ; pos++) {
+		unsigned char c = tolower((unsigned char) line[pos]);
+
+		while (node && line_rule_node[node].c != c)
+			node = line_rule_node[node].next;
+		if (!node) {
+			/* Adding a node may move the parent node. */
+			node = add_line_rule_node(parent ? line_rule_node[parent].child
+							 : line_rule_first[c], c);
+			if (parent)
+				line_rule_node[parent].child = node;
+			else
+				line_rule_first[c] = node;
+		}
+
+		if (pos + 1 == linelen)
+			break;
+		parent = node;
+		node = line_rule_node[node].child;
+	}
+
+	if (line_rule_node[node].rule == -1)
+		line_rule_node[node].rule = rule;
+}
+
+static void
+compile_line_rules(void)
+{
+	enum line_type type;
+	int rule = 0;
+
+	/* Node 0 is reserved so it can be used to mean no node. */
+	line_rule_nodes = 0;
+	add_line_rule_node(0, 0);
+	memset(line_rule_first, 0, sizeof(line_rule_first));
+	line_rule_empty = -1;
+
+	for (type = 0; type < custom_colors + ARRAY_SIZE(line_info); type++, rule++) {
+		struct line_info *info = type < custom_colors
+				       ? &custom_color[type] : &line_info[type - custom_colors];
+
+		if (!info->linelen) {
+			if (line_rule_empty == -1)
+				line_rule_empty = rule;
+			continue;
+		}
+
+		add_line_rule(info->line, info->linelen, rule);
+	}
+
+	line_rules_compiled = TRUE;
+}
+
 static enum line_type
 get_line_type(const char *line)
 {
-	int linelen = strlen(line);
-	enum line_type type;
+	int rule, node;
 
-	for (type = 0; type < custom_colors; type++)
-		/* Case insensitive search matches Signed-off-by lines better. */
-		if (linelen >= custom_color[type].linelen &&
-		    !strncasecmp(custom_color[type].line, line, custom_color[type].linelen))
-			return TO_CUSTOM_COLOR_TYPE(type);
+	if (!line_rules_compiled)
+		compile_line_rules();
 
-	for (type = 0; type < ARRAY_SIZE(line_info); type++)
-		/* Case insensitive search matches Signed-off-by lines better. */
-		if (linelen >= line_info[type].linelen &&
-		    !strncasecmp(line_info[type].line, line, line_info[type].linelen))
-			return type;
+	rule = line_rule_empty;
+	node = line_rule_first[tolower((unsigned char) *line)];
+	while (node && *line) {
+		unsigned char c = tolower((unsigned char) *line);
+
+		if (line_rule_node[node].c != c) {
+			node = line_rule_node[node].next;
+			continue;
+		}
+
+		if (line_rule_node[node].rule != -1 &&
+		    (rule == -1 || line_rule_node[node].rule < rule))
+			rule = line_rule_node[node].rule;
+		node = line_rule_node[node].child;
+		line++;
+	}
 
-	return LINE_DEFAULT;
+	if (rule == -1)
+		return LINE_DEFAULT;
+	if (rule < custom_colors)
+		return TO_CUSTOM_COLOR_TYPE(rule);
+	return rule - custom_colors;
 }
 
 static enum line_type
@@ -824,6 +968,7 @@ add_custom_color(const char *quoted_line)
 	info = &custom_color[custom_colors++];
 	info->name = info->line = line;
 	info->namelen = info->linelen = strlen(line);
+	line_rules_compiled = FALSE;
 
 	return info;
 }
@@ -888,6 +1033,7 @@ struct line {
 	unsigned int dirty:1;
 	unsigned int cleareol:1;
 	unsigned int wrapped:1;
+	unsigned int search_result:1;
 
 	unsigned int user_flags:6;
 	void *data;		/* User data */
@@ -939,6 +1085,7 @@ static struct keybinding default_keybindings[] = {
 	{ '1',		REQ_STAGE_UPDATE_LINE },
 	{ '@',		REQ_STAGE_NEXT },
 	{ '\\',		REQ_STAGE_SPLIT_CHUNK },
+	{ 'a',		REQ_STAGE_QUEUE },
 	{ '[',		REQ_DIFF_CONTEXT_DOWN },
 	{ ']',		REQ_DIFF_CONTEXT_UP },
 
@@ -1525,6 +1672,9 @@ option_set_command(int argc, const char *argv[])
 	if (!strcmp(argv[0], "show-rev-graph"))
 		return parse_bool(&opt_rev_graph, argv[2]);
 
+	if (!strcmp(argv[0], "rev-graph-width"))
+		return parse_int(&opt_rev_graph_width, argv[2], 0, 1024);
+
 	if (!strcmp(argv[0], "show-refs"))
 		return parse_bool(&opt_show_refs, argv[2]);
 
@@ -1658,6 +1808,15 @@ option_set_command(int argc, const char *argv[])
 	if (!strcmp(argv[0], "mouse-scroll"))
 		return parse_int(&opt_scroll_wheel_lines, argv[2], 0, 1024);
 
+	if (!strcmp(argv[0], "main-view-page-size"))
+		return parse_int(&opt_main_view_page_size, argv[2], 0, 999999);
+
+	if (!strcmp(argv[0], "diff-view-page-size"))
+		return parse_int(&opt_diff_view_page_size, argv[2], 0, 999999);
+
+	if (!strcmp(argv[0], "main-view-cache"))
+		return parse_bool(&opt_main_view_cache, argv[2]);
+
 	return ERROR_UNKNOWN_VARIABLE_NAME;
 }
 
@@ -1914,6 +2073,7 @@ enum view_flag {
 	VIEW_FILE_FILTER	= 1 << 10,
 	VIEW_LOG_LIKE		= 1 << 11,
 	VIEW_STATUS_LIKE	= 1 << 12,
+	VIEW_WRAP_LINES		= 1 << 13,
 };
 
 #define view_has_flags(view, flag)	((view)->ops->flags & (flag))
@@ -1943,6 +2103,13 @@ struct view {
 	/* Searching */
 	char grep[SIZEOF_STR];	/* Search string */
 	regex_t *regex;		/* Pre-compiled regexp */
+	char grep_literal[SIZEOF_STR]; /* Text contained in all matches */
+	size_t grep_literal_len;
+	bool grep_icase;	/* Whether the search ignores case */
+	bool grep_is_literal;	/* Whether the search string is plain text */
+	unsigned long *matches;	/* Sorted lines matching the search */
+	size_t matches_size;
+	unsigned long matches_checked; /* Lines searched for matches */
 
 	/* If non-NULL, points to the view that opened this view. If this view
 	 * is closed tig will switch back to the parent view. */
@@ -1952,11 +2119,15 @@ struct view {
 	/* Buffering */
 	size_t lines;		/* Total number of lines */
 	struct line *line;	/* Line index */
+	struct view_chunk *chunks; /* Storage for the data of all lines. */
 	unsigned int digits;	/* Number of digits in the lines member. */
 
 	/* Number of lines with custom status, not to be counted in the
 	 * view title. */
 	unsigned int custom_lines;
+	size_t wrap_width;	/* Width the lines are wrapped at, or 0. */
+	bool renumber;		/* Whether lines need to be numbered again. */
+	unsigned long renumber_from; /* First line to number again. */
 
 	/* Drawing */
 	struct line *curline;	/* Line currently being drawn. */
@@ -1964,6 +2135,8 @@ struct view {
 	unsigned long col;	/* Column when drawing. */
 	bool has_scrolled;	/* View was scrolled. */
 	bool force_redraw;	/* Whether to force a redraw after reading. */
+	bool redraw_pending;	/* Lines read since the last redraw. */
+	struct timeval redraw_time; /* When lines read were last drawn. */
 
 	/* Loading */
 	const char **argv;	/* Shell command arguments. */
@@ -1974,6 +2147,8 @@ struct view {
 	time_t update_secs;
 	struct encoding *encoding;
 	bool unrefreshable;
+	size_t max_lines;	/* Pause reading at this many lines, if set. */
+	bool stopping;		/* Reading is being stopped, do not wait. */
 
 	/* Private data */
 	void *private;
@@ -2040,6 +2215,12 @@ static struct view views[] = {
 #define view_has_line(view, line_) \
 	((view)->line <= (line_) && (line_) < (view)->line + (view)->lines)
 
+#define view_is_paused(view) \
+	((view)->max_lines && (view)->lines >= (view)->max_lines)
+
+#define view_is_loading(view) \
+	((view)->pipe && !view_is_paused(view))
+
 static bool
 forward_request_to_child(struct view *child, enum request request)
 {
@@ -2372,6 +2553,35 @@ draw_refs(struct view *view, struct ref_list *refs)
 	return FALSE;
 }
 
+/* Number the lines again after lines were inserted. Custom lines have
+ * no number and wrapped rows share the number of the line they are
+ * part of. */
+static void
+update_line_numbers(struct view *view)
+{
+	unsigned long lineno = 0;
+	size_t i;
+
+	if (!view->renumber)
+		return;
+
+	for (i = view->renumber_from; i > 0; i--) {
+		if (view->line[i - 1].lineno) {
+			lineno = view->line[i - 1].lineno;
+			break;
+		}
+	}
+
+	for (i = view->renumber_from; i < view->lines; i++) {
+		struct line *line = &view->line[i];
+
+		if (line->lineno)
+			line->lineno = line->wrapped ? lineno : ++lineno;
+	}
+
+	view->renumber = FALSE;
+}
+
 static bool
 draw_view_line(struct view *view, unsigned int lineno)
 {
@@ -2383,6 +2593,7 @@ draw_view_line(struct view *view, unsigned int lineno)
 	if (view->pos.offset + lineno >= view->lines)
 		return FALSE;
 
+	update_line_numbers(view);
 	line = &view->line[view->pos.offset + lineno];
 
 	wmove(view->win, lineno, 0);
@@ -2398,6 +2609,10 @@ draw_view_line(struct view *view, unsigned int lineno)
 		set_view_attr(view, LINE_CURSOR);
 		line->selected = TRUE;
 		view->ops->select(view, line);
+	} else if (line->search_result) {
+		/* Highlight the whole line like the cursor line. */
+		set_view_attr(view, LINE_SEARCH_RESULT);
+		line->selected = TRUE;
 	}
 
 	return view->ops->draw(view, line, lineno);
@@ -2445,6 +2660,24 @@ redraw_view(struct view *view)
 }
 
 
+/* Find the first line matching the search at or after lineno. */
+static size_t
+find_search_match(struct view *view, unsigned long lineno)
+{
+	size_t low = 0, high = view->matches_size;
+
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if (view->matches[mid] < lineno)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
 static void
 update_view_title(struct view *view)
 {
@@ -2453,6 +2686,7 @@ update_view_title(struct view *view)
 	unsigned int view_lines, lines;
 
 	assert(view_is_displayed(view));
+	update_line_numbers(view);
 
 	if (view == display[current_view])
 		wbkgdset(window, get_line_attr(LINE_TITLE_FOCUS));
@@ -2468,13 +2702,24 @@ update_view_title(struct view *view)
 
 	if (!view_has_flags(view, VIEW_CUSTOM_STATUS) && view_has_line(view, line) &&
 	    line->lineno) {
-		wprintw(window, " - %s %d of %zd",
+		wprintw(window, " - %s %d of %zd%s",
 					   view->ops->type,
 					   line->lineno,
-					   view->lines - view->custom_lines);
+					   view->lines - view->custom_lines,
+					   view_is_paused(view) ? "+" : "");
 	}
 
-	if (view->pipe) {
+	if (*view->grep && !view->pipe && view->matches_checked == view->lines) {
+		size_t match = find_search_match(view, view->pos.lineno);
+
+		if (match < view->matches_size && view->matches[match] == view->pos.lineno)
+			wprintw(window, " - match %zd of %zd", match + 1, view->matches_size);
+		else
+			wprintw(window, " - %zd match%s", view->matches_size,
+				view->matches_size == 1 ? "" : "es");
+	}
+
+	if (view_is_loading(view)) {
 		time_t secs = time(NULL) - view->start_time;
 
 		/* Three git seconds are a long time ... */
@@ -2531,6 +2776,8 @@ redraw_display_separator(bool clear)
 	}
 }
 
+static void rewrap_view(struct view *view);
+
 static void
 resize_display(void)
 {
@@ -2606,6 +2853,8 @@ resize_display(void)
 			x += view->width + 1;
 		else
 			y += view->height + 1;
+
+		rewrap_view(view);
 	}
 
 	redraw_display_separator(FALSE);
@@ -2952,20 +3201,171 @@ move_view(struct view *view, enum request request)
  * Searching
  */
 
+static long
+usecs_since(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000 + now.tv_usec - start->tv_usec;
+}
+
+static bool
+input_is_pending(void)
+{
+	struct timeval tv = { 0, 0 };
+	fd_set fds;
+
+	if (!opt_tty)
+		return FALSE;
+
+	FD_ZERO(&fds);
+	FD_SET(fileno(opt_tty), &fds);
+
+	return select(fileno(opt_tty) + 1, &fds, NULL, NULL, &tv) > 0;
+}
+
+/* Number of lines searched between checks for user input. */
+#define FIND_NEXT_LINES		4096
+/* Time after which a search reports its progress. */
+#define FIND_NEXT_REPORT_USECS	200000
+
 static void search_view(struct view *view, enum request request);
 
+/* Searches of the main view starting with these options are passed to
+ * git log to search the content or messages of all commits. */
 static bool
-grep_text(struct view *view, const char *text[])
+is_history_search(struct view *view, const char *search)
+{
+	return view->ops == &main_ops &&
+	       (!prefixcmp(search, "-S") || !prefixcmp(search, "-G") ||
+		!prefixcmp(search, "--grep="));
+}
+
+/* Whether the search may become a history search as more is typed. */
+static bool
+is_history_search_prefix(struct view *view, const char *search)
+{
+	size_t len = strlen(search);
+
+	return is_history_search(view, search) ||
+	       (view->ops == &main_ops && len &&
+		(!strncmp(search, "-S", len) || !strncmp(search, "-G", len) ||
+		 !strncmp(search, "--grep=", len)));
+}
+
+static bool
+grep_literal(struct view *view, const char *text)
+{
+	const char *literal = view->grep_literal;
+	size_t len = view->grep_literal_len;
+	char first[3] = { literal[0] };
+
+	if (!view->grep_icase)
+		return !!strstr(text, literal);
+
+	first[0] = tolower(literal[0]);
+	first[1] = toupper(literal[0]);
+	for (; (text = strpbrk(text, first)); text++)
+		if (!strncasecmp(text, literal, len))
+			return TRUE;
+	return FALSE;
+}
+
+/* Only run the regexp on text containing the literal part of the search. */
+static bool
+grep_string(struct view *view, const char *text)
 {
 	regmatch_t pmatch;
+
+	if (view->grep_literal_len && !grep_literal(view, text))
+		return FALSE;
+	return view->grep_is_literal || !regexec(view->regex, text, 1, &pmatch, 0);
+}
+
+static bool
+grep_text(struct view *view, const char *text[])
+{
 	size_t i;
 
 	for (i = 0; text[i]; i++)
-		if (*text[i] && !regexec(view->regex, text[i], 1, &pmatch, 0))
+		if (*text[i] && grep_string(view, text[i]))
 			return TRUE;
 	return FALSE;
 }
 
+/* Find the longest run of plain characters outside of any group which
+ * all matches of the extended regexp must contain. Searches with '|' are
+ * not considered and when ignoring case only ASCII characters are used,
+ * since they can be compared without knowing the locale. */
+static size_t
+get_search_literal(const char *pattern, char literal[SIZEOF_STR], bool icase)
+{
+	const char *run = pattern;
+	size_t len = 0, best = 0;
+	int depth = 0;
+
+	if (strchr(pattern, '|'))
+		return 0;
+
+	for (; ; pattern++) {
+		if (*pattern && !strchr(".[]()*+?{}^$\\", *pattern) &&
+		    !(icase && (*pattern & 0x80))) {
+			if (!len++)
+				run = pattern;
+			continue;
+		}
+
+		/* The last character, which may span multiple bytes, is
+		 * optional when followed by these. */
+		if (len && (*pattern == '*' || *pattern == '?' || *pattern == '{')) {
+			do {
+				len--;
+			} while (len && (run[len] & 0xC0) == 0x80);
+		}
+
+		if (!depth && len > best && len < SIZEOF_STR) {
+			best = len;
+			string_ncopy_do(literal, SIZEOF_STR, run, len);
+		}
+		len = 0;
+
+		if (*pattern == '\\' && pattern[1]) {
+			pattern++;
+
+		} else if (*pattern == '(') {
+			depth++;
+
+		} else if (*pattern == ')') {
+			if (depth)
+				depth--;
+
+		} else if (*pattern == '[') {
+			/* Skip the bracket expression. */
+			pattern++;
+			if (*pattern == '^')
+				pattern++;
+			if (*pattern == ']')
+				pattern++;
+			for (; *pattern && *pattern != ']'; pattern++) {
+				if (*pattern == '[' && strchr(".:=", pattern[1])) {
+					char end[] = { pattern[1], ']', 0 };
+					const char *class_end = strstr(pattern + 2, end);
+
+					if (!class_end)
+						return 0;
+					pattern = class_end + 1;
+				}
+			}
+		}
+
+		if (!*pattern)
+			break;
+	}
+
+	return best;
+}
+
 static void
 select_view_line(struct view *view, unsigned long lineno)
 {
@@ -2986,10 +3386,126 @@ select_view_line(struct view *view, unsigned long lineno)
 	}
 }
 
+/* Look for the next line matching the search starting at lineno. */
+static bool
+find_next_line(struct view *view, unsigned long *lineno_ptr, int direction, bool *interrupted)
+{
+	unsigned long lineno = *lineno_ptr;
+	unsigned long lines = direction > 0 ? view->lines - lineno : lineno + 1;
+	unsigned long searched = 0;
+	struct timeval start;
+
+	*interrupted = FALSE;
+	gettimeofday(&start, NULL);
+
+	/* Note, lineno is unsigned long so will wrap around in which case it
+	 * will become bigger than view->lines. */
+	for (; lineno < view->lines; lineno += direction) {
+		if (view->ops->grep(view, &view->line[lineno])) {
+			*lineno_ptr = lineno;
+			return TRUE;
+		}
+
+		/* Let long searches be interrupted by pressing any key. */
+		if (++searched % FIND_NEXT_LINES == 0 &&
+		    usecs_since(&start) >= FIND_NEXT_REPORT_USECS) {
+			if (input_is_pending()) {
+				*interrupted = TRUE;
+				return FALSE;
+			}
+
+			report("Searching for '%s' (%lu%%)", view->grep, searched * 100 / lines);
+			doupdate();
+		}
+	}
+
+	return FALSE;
+}
+
+DEFINE_ALLOCATOR(realloc_matches, unsigned long, 1024)
+
+/* Number of lines checked between checks for user input when indexing. */
+#define SEARCH_MATCHES_LINES	1024
+/* Time spent indexing matches before returning to the main loop. */
+#define SEARCH_MATCHES_USECS	20000
+
+static void
+reset_search_matches(struct view *view)
+{
+	size_t i;
+
+	for (i = 0; i < view->matches_size; i++) {
+		struct line *line = &view->line[view->matches[i]];
+
+		line->search_result = 0;
+		line->dirty = 1;
+	}
+
+	view->matches_size = 0;
+	view->matches_checked = 0;
+}
+
+/* Index the lines matching the search of a view which has finished
+ * loading, a few lines at a time. Returns whether lines are left. */
+static bool
+update_search_matches(struct view *view)
+{
+	unsigned long checked = view->matches_checked;
+	struct timeval start;
+
+	if (view->pipe)
+		return FALSE;
+
+	gettimeofday(&start, NULL);
+
+	while (*view->grep && view->matches_checked < view->lines) {
+		unsigned long lineno = view->matches_checked++;
+		struct line *line = &view->line[lineno];
+
+		if (view->ops->grep(view, line)) {
+			if (!realloc_matches(&view->matches, view->matches_size, 1))
+				break;
+			view->matches[view->matches_size++] = lineno;
+			line->search_result = line->dirty = 1;
+		}
+
+		if (view->matches_checked % SEARCH_MATCHES_LINES == 0 &&
+		    (usecs_since(&start) >= SEARCH_MATCHES_USECS || input_is_pending()))
+			break;
+	}
+
+	if (view_is_displayed(view)) {
+		redraw_view_dirty(view);
+		if (checked != view->matches_checked &&
+		    view->matches_checked == view->lines)
+			update_view_title(view);
+	}
+
+	return *view->grep && view->matches_checked < view->lines;
+}
+
+/* Look up the next matching line in the index of matches. */
+static bool
+find_next_match(struct view *view, unsigned long *lineno, int direction)
+{
+	size_t match;
+
+	if (*lineno >= view->lines)
+		return FALSE;
+
+	match = find_search_match(view, *lineno + (direction < 0));
+	if (direction < 0 ? match == 0 : match == view->matches_size)
+		return FALSE;
+
+	*lineno = view->matches[direction < 0 ? match - 1 : match];
+	return TRUE;
+}
+
 static void
 find_next(struct view *view, enum request request)
 {
 	unsigned long lineno = view->pos.lineno;
+	bool found, interrupted = FALSE;
 	int direction;
 
 	if (!*view->grep) {
@@ -3018,46 +3534,63 @@ find_next(struct view *view, enum request request)
 	if (request == REQ_FIND_NEXT || request == REQ_FIND_PREV)
 		lineno += direction;
 
-	/* Note, lineno is unsigned long so will wrap around in which case it
-	 * will become bigger than view->lines. */
-	for (; lineno < view->lines; lineno += direction) {
-		if (view->ops->grep(view, &view->line[lineno])) {
-			select_view_line(view, lineno);
-			report("Line %ld matches '%s'", lineno + 1, view->grep);
-			return;
-		}
-	}
+	/* Use the index of matches once all lines have been checked. */
+	if (!view->pipe && view->matches_checked == view->lines)
+		found = find_next_match(view, &lineno, direction);
+	else
+		found = find_next_line(view, &lineno, direction, &interrupted);
 
-	report("No match found for '%s'", view->grep);
+	if (found) {
+		select_view_line(view, lineno);
+		report("Line %ld matches '%s'", lineno + 1, view->grep);
+	} else if (interrupted) {
+		report("Search for '%s' was interrupted", view->grep);
+	} else {
+		report("No match found for '%s'", view->grep);
+	}
 }
 
-static void
-search_view(struct view *view, enum request request)
+static bool
+compile_search(struct view *view, const char *search)
 {
 	int regex_err;
 	int regex_flags = opt_ignore_case ? REG_ICASE : 0;
 
+	reset_search_matches(view);
+
 	if (view->regex) {
 		regfree(view->regex);
 		*view->grep = 0;
 	} else {
 		view->regex = calloc(1, sizeof(*view->regex));
 		if (!view->regex)
-			return;
+			return FALSE;
 	}
 
-	regex_err = regcomp(view->regex, opt_search, REG_EXTENDED | regex_flags);
+	regex_err = regcomp(view->regex, search, REG_EXTENDED | regex_flags);
 	if (regex_err != 0) {
 		char buf[SIZEOF_STR] = "unknown error";
 
 		regerror(regex_err, view->regex, buf, sizeof(buf));
 		report("Search failed: %s", buf);
-		return;
+		/* Only keep compiled regexps so they can be freed. */
+		free(view->regex);
+		view->regex = NULL;
+		return FALSE;
 	}
 
-	string_copy(view->grep, opt_search);
+	string_ncopy(view->grep, search, strlen(search));
+	view->grep_icase = opt_ignore_case;
+	view->grep_literal_len = get_search_literal(search, view->grep_literal, view->grep_icase);
+	view->grep_is_literal = view->grep_literal_len == strlen(search);
+	return TRUE;
+}
 
-	find_next(view, request);
+static void
+search_view(struct view *view, enum request request)
+{
+	if (compile_search(view, opt_search))
+		find_next(view, request);
 }
 
 /*
@@ -3076,25 +3609,79 @@ clear_position(struct position *pos)
 	memset(pos, 0, sizeof(*pos));
 }
 
-static void
-reset_view(struct view *view)
-{
-	int i;
+/*
+ * Line data is allocated from chunks owned by the view. Nothing is freed
+ * until the view is reset, which frees all chunks at once.
+ */
 
-	if (view->ops->done)
-		view->ops->done(view);
+#define VIEW_CHUNK_SIZE	(32 * 1024)
 
-	for (i = 0; i < view->lines; i++)
-		free(view->line[i].data);
-	free(view->line);
+struct view_chunk {
+	struct view_chunk *next;
+	size_t size;
+	size_t used;
+};
 
-	view->prev_pos = view->pos;
-	clear_position(&view->pos);
+static void *
+view_alloc(struct view *view, size_t size)
+{
+	struct view_chunk *chunk = view->chunks;
+	void *data;
+
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (!chunk || chunk->used + size > chunk->size) {
+		size_t chunk_size = MAX(size, VIEW_CHUNK_SIZE);
+
+		/* Put large allocations in a chunk of their own behind the
+		 * current chunk so it can still be filled. */
+		chunk = calloc(1, sizeof(*chunk) + chunk_size);
+		if (!chunk)
+			return NULL;
+		chunk->size = chunk_size;
+		if (size > VIEW_CHUNK_SIZE / 4 && view->chunks) {
+			chunk->next = view->chunks->next;
+			view->chunks->next = chunk;
+		} else {
+			chunk->next = view->chunks;
+			view->chunks = chunk;
+		}
+	}
+
+	data = (char *) (chunk + 1) + chunk->used;
+	chunk->used += size;
+	return data;
+}
+
+static void
+view_free_chunks(struct view *view)
+{
+	while (view->chunks) {
+		struct view_chunk *chunk = view->chunks;
+
+		view->chunks = chunk->next;
+		free(chunk);
+	}
+}
+
+static void
+reset_view(struct view *view)
+{
+	if (view->ops->done)
+		view->ops->done(view);
+
+	reset_search_matches(view);
+	view_free_chunks(view);
+	free(view->line);
+
+	view->prev_pos = view->pos;
+	clear_position(&view->pos);
 
 	view->line = NULL;
 	view->lines  = 0;
 	view->vid[0] = 0;
 	view->custom_lines = 0;
+	view->wrap_width = 0;
+	view->renumber = FALSE;
 	view->update_secs = 0;
 }
 
@@ -3262,9 +3849,11 @@ end_update(struct view *view, bool force)
 {
 	if (!view->pipe)
 		return;
+	view->stopping = force;
 	while (!view->ops->read(view, NULL))
 		if (!force)
 			return;
+	view->stopping = FALSE;
 	if (force)
 		io_kill(view->pipe);
 	io_done(view->pipe);
@@ -3336,6 +3925,43 @@ begin_update(struct view *view, const char *dir, const char **argv, enum open_fl
 	return TRUE;
 }
 
+/* Time spent reading from a view's pipe before returning to the main
+ * loop to redraw and handle input. */
+#define UPDATE_VIEW_USECS	50000
+/* Minimum time between redraws of a view while it is loading. */
+#define UPDATE_VIEW_REDRAW_USECS	100000
+
+static bool
+update_view_has_time(struct timeval *start)
+{
+	return usecs_since(start) < UPDATE_VIEW_USECS;
+}
+
+static void
+update_view_redraw(struct view *view, bool redraw)
+{
+	if (redraw || view->force_redraw)
+		redraw_view_from(view, 0);
+	else
+		redraw_view_dirty(view);
+	view->force_redraw = FALSE;
+	view->redraw_pending = FALSE;
+	gettimeofday(&view->redraw_time, NULL);
+
+	/* Update the title _after_ the redraw so that if the redraw picks up a
+	 * commit reference in view->ref it'll be available here. */
+	update_view_title(view);
+}
+
+/* Lines read while a view is loading are drawn at most every
+ * UPDATE_VIEW_REDRAW_USECS, unless the user is waiting on a key press. */
+static bool
+update_view_redraw_is_due(struct view *view)
+{
+	return !view->pipe || view_is_paused(view) || input_is_pending() ||
+	       usecs_since(&view->redraw_time) >= UPDATE_VIEW_REDRAW_USECS;
+}
+
 static bool
 update_view(struct view *view)
 {
@@ -3343,13 +3969,21 @@ update_view(struct view *view)
 	/* Clear the view and redraw everything since the tree sorting
 	 * might have rearranged things. */
 	bool redraw = view->lines == 0;
-	bool can_read = TRUE;
+	bool can_read;
 	struct encoding *encoding = view->encoding ? view->encoding : default_encoding;
+	struct timeval start;
 
-	if (!view->pipe)
+	if (!view->pipe || view_is_paused(view))
 		return TRUE;
 
-	if (!io_can_read(view->pipe, FALSE)) {
+	/* Lines left in the buffer when reading was paused can be
+	 * consumed without waiting for the pipe. */
+	can_read = io_can_read(view->pipe, FALSE);
+	if (!can_read && !(view->max_lines && view->pipe->bufsize)) {
+		if (view->redraw_pending && view_is_displayed(view) &&
+		    update_view_redraw_is_due(view))
+			update_view_redraw(view, FALSE);
+
 		if (view->lines == 0 && view_is_displayed(view)) {
 			time_t secs = time(NULL) - view->start_time;
 
@@ -3363,17 +3997,27 @@ update_view(struct view *view)
 		return TRUE;
 	}
 
-	for (; (line = io_get(view->pipe, '\n', can_read)); can_read = FALSE) {
-		if (encoding) {
-			line = encoding_convert(encoding, line);
-		}
+	gettimeofday(&start, NULL);
 
-		if (!view->ops->read(view, line)) {
-			report("Allocation failure");
-			end_update(view, TRUE);
-			return FALSE;
+	do {
+		for (; !view_is_paused(view) && (line = io_get(view->pipe, '\n', can_read));
+		     can_read = FALSE) {
+			if (encoding) {
+				line = encoding_convert(encoding, line);
+			}
+
+			if (!view->ops->read(view, line)) {
+				report("Allocation failure");
+				end_update(view, TRUE);
+				return FALSE;
+			}
 		}
-	}
+
+		/* Keep reading while git is producing output so each batch
+		 * of lines is not followed by a redraw. */
+	} while (!view_is_paused(view) && !io_eof(view->pipe) &&
+		 update_view_has_time(&start) && !input_is_pending() &&
+		 (can_read = io_can_read(view->pipe, FALSE)));
 
 	{
 		int digits = count_digits(view->lines);
@@ -3390,7 +4034,7 @@ update_view(struct view *view)
 		report("Failed to read: %s", io_strerror(view->pipe));
 		end_update(view, TRUE);
 
-	} else if (io_eof(view->pipe)) {
+	} else if (io_eof(view->pipe) && !view->pipe->bufsize) {
 		end_update(view, FALSE);
 	}
 
@@ -3400,31 +4044,62 @@ update_view(struct view *view)
 	if (!view_is_displayed(view))
 		return TRUE;
 
-	if (redraw || view->force_redraw)
-		redraw_view_from(view, 0);
-	else
-		redraw_view_dirty(view);
-	view->force_redraw = FALSE;
+	if (!update_view_redraw_is_due(view)) {
+		view->force_redraw |= redraw;
+		view->redraw_pending = TRUE;
+		return TRUE;
+	}
 
-	/* Update the title _after_ the redraw so that if the redraw picks up a
-	 * commit reference in view->ref it'll be available here. */
-	update_view_title(view);
+	update_view_redraw(view, redraw);
 	return TRUE;
 }
 
-DEFINE_ALLOCATOR(realloc_lines, struct line, 256)
+/* The line index grows by doubling its size so appending to views with
+ * millions of lines does not keep copying the index. */
+static size_t
+lines_alloc_size(size_t lines)
+{
+	size_t size = 256;
+
+	while (size < lines)
+		size *= 2;
+	return size;
+}
+
+static struct line *
+realloc_lines(struct line **lines, size_t size, size_t increase)
+{
+	size_t alloc = size ? lines_alloc_size(size) : 0;
+	size_t new_alloc = lines_alloc_size(size + increase);
+	struct line *tmp = *lines;
+
+	if (alloc != new_alloc) {
+		tmp = realloc(tmp, new_alloc * sizeof(*tmp));
+		if (!tmp)
+			return NULL;
+		memset(tmp + alloc, 0, (new_alloc - alloc) * sizeof(*tmp));
+		*lines = tmp;
+	}
+
+	return tmp;
+}
 
 static struct line *
 add_line_at(struct view *view, unsigned long pos, const void *data, enum line_type type, size_t data_size, bool custom)
 {
 	struct line *line;
 	unsigned long lineno;
+	bool insert = pos < view->lines;
 
 	if (!realloc_lines(&view->line, view->lines, 1))
 		return NULL;
 
+	/* The matching lines will be searched again. */
+	if (insert)
+		reset_search_matches(view);
+
 	if (data_size) {
-		void *alloc_data = calloc(1, data_size);
+		void *alloc_data = view_alloc(view, data_size);
 
 		if (!alloc_data)
 			return NULL;
@@ -3434,15 +4109,24 @@ add_line_at(struct view *view, unsigned long pos, const void *data, enum line_ty
 		data = alloc_data;
 	}
 
-	if (pos < view->lines) {
-		view->lines++;
-		line = view->line + pos;
-		lineno = line->lineno;
+	if (insert) {
+		unsigned long i = MAX(pos + 1, view->pos.offset);
+		unsigned long end = view->pos.offset + view->height;
 
+		line = view->line + pos;
 		memmove(line + 1, line, (view->lines - pos) * sizeof(*view->line));
-		while (pos < view->lines) {
-			view->line[pos].lineno++;
-			view->line[pos++].dirty = 1;
+		view->lines++;
+
+		/* Lines below the screen are drawn when scrolled to. */
+		for (; i < view->lines && i < end; i++)
+			view->line[i].dirty = view->line[i].cleareol = 1;
+
+		/* Number the lines when they are next drawn. Custom lines
+		 * are not numbered, so other lines keep their number. */
+		lineno = 1;
+		if (!custom && (!view->renumber || pos < view->renumber_from)) {
+			view->renumber = TRUE;
+			view->renumber_from = pos;
 		}
 	} else {
 		line = &view->line[view->lines++];
@@ -3453,6 +4137,7 @@ add_line_at(struct view *view, unsigned long pos, const void *data, enum line_ty
 	line->type = type;
 	line->data = (void *) data;
 	line->dirty = 1;
+	line->cleareol = insert;
 
 	if (custom)
 		view->custom_lines++;
@@ -3549,10 +4234,14 @@ load_view(struct view *view, struct view *prev, enum open_flags flags)
 	if (view->pipe)
 		end_update(view, TRUE);
 	if (view->ops->private_size) {
-		if (!view->private)
+		if (!view->private) {
 			view->private = calloc(1, view->ops->private_size);
-		else
+		} else {
+			/* Free what the old state owns before clearing it. */
+			if (view->ops->done)
+				view->ops->done(view);
 			memset(view->private, 0, view->ops->private_size);
+		}
 	}
 
 	/* When prev == view it means this is the first loaded view. */
@@ -3891,7 +4580,11 @@ view_driver(struct view *view, enum request request)
 		{
 			char action[SIZEOF_STR] = "";
 			enum view_flag flags = toggle_option(view, request, action);
-	
+
+			/* Options may change the text being searched. */
+			foreach_view (view, i)
+				reset_search_matches(view);
+
 			if (flags == VIEW_FLAG_RESET_DISPLAY) {
 				resize_display();
 				redraw_display(TRUE);
@@ -4043,88 +4736,188 @@ update_diff_context(enum request request)
 	return diff_context != opt_diff_context;
 }
 
-DEFINE_ALLOCATOR(realloc_paths, const char *, 256)
+/*
+ * Interned strings to reduce memory consumption. Entries are found using
+ * a hash table with open addressing and are allocated from large chunks.
+ * No entries are ever freed.
+ */
+
+#define INTERN_CHUNK_SIZE	(64 * 1024)
+#define INTERN_HASH_INIT	2166136261U
+
+struct intern_entry {
+	unsigned int hash;
+	const void *data;
+};
+
+struct intern_table {
+	struct intern_entry *entries;
+	size_t slots;			/* Number of entries, a power of two. */
+	size_t size;			/* Number of used entries. */
+};
+
+typedef bool (*intern_equal_fn)(const void *data, const void *key);
+
+static void *
+intern_alloc(size_t size)
+{
+	static char *chunk;
+	static size_t chunk_pos, chunk_size;
+	void *data;
+
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (chunk_pos + size > chunk_size) {
+		size_t alloc = MAX(size, INTERN_CHUNK_SIZE);
+
+		chunk = malloc(alloc);
+		if (!chunk)
+			return NULL;
+		chunk_pos = 0;
+		chunk_size = alloc;
+	}
+
+	data = chunk + chunk_pos;
+	chunk_pos += size;
+	return data;
+}
 
-/* Small cache to reduce memory consumption. It uses binary search to
- * lookup or find place to position new entries. No entries are ever
- * freed. */
 static const char *
-get_path(const char *path)
+intern_strdup(const char *str)
 {
-	static const char **paths;
-	static size_t paths_size;
-	int from = 0, to = paths_size - 1;
-	char *entry;
+	size_t size = strlen(str) + 1;
+	char *copy = intern_alloc(size);
 
-	while (from <= to) {
-		size_t pos = (to + from) / 2;
-		int cmp = strcmp(path, paths[pos]);
+	if (copy)
+		memcpy(copy, str, size);
+	return copy;
+}
 
-		if (!cmp)
-			return paths[pos];
+/* FNV-1a hash which can be chained over several strings. */
+static unsigned int
+intern_hash(unsigned int hash, const char *str)
+{
+	while (*str)
+		hash = (hash ^ (unsigned char) *str++) * 16777619U;
+	return hash;
+}
 
-		if (cmp < 0)
-			to = pos - 1;
-		else
-			from = pos + 1;
+static bool
+intern_grow(struct intern_table *table)
+{
+	size_t slots = table->slots ? table->slots * 2 : 256;
+	struct intern_entry *entries = calloc(slots, sizeof(*entries));
+	size_t i;
+
+	if (!entries)
+		return FALSE;
+
+	for (i = 0; i < table->slots; i++) {
+		struct intern_entry *entry = &table->entries[i];
+		size_t pos = entry->hash & (slots - 1);
+
+		if (!entry->data)
+			continue;
+		while (entries[pos].data)
+			pos = (pos + 1) & (slots - 1);
+		entries[pos] = *entry;
 	}
 
-	if (!realloc_paths(&paths, paths_size, 1))
+	free(table->entries);
+	table->entries = entries;
+	table->slots = slots;
+	return TRUE;
+}
+
+/* Returns the entry matching the key or the empty entry where it should
+ * be added, or NULL if the table could not be grown. */
+static struct intern_entry *
+intern_find(struct intern_table *table, unsigned int hash, intern_equal_fn equal, const void *key)
+{
+	size_t pos;
+
+	if (table->size * 2 >= table->slots && !intern_grow(table))
 		return NULL;
-	entry = strdup(path);
+
+	for (pos = hash & (table->slots - 1);
+	     table->entries[pos].data;
+	     pos = (pos + 1) & (table->slots - 1)) {
+		struct intern_entry *entry = &table->entries[pos];
+
+		if (entry->hash == hash && equal(entry->data, key))
+			break;
+	}
+
+	return &table->entries[pos];
+}
+
+static void
+intern_add(struct intern_table *table, struct intern_entry *entry, unsigned int hash, const void *data)
+{
+	entry->hash = hash;
+	entry->data = data;
+	table->size++;
+}
+
+static bool
+path_equals(const void *data, const void *key)
+{
+	return !strcmp(data, key);
+}
+
+static const char *
+get_path(const char *path)
+{
+	static struct intern_table paths;
+	unsigned int hash = intern_hash(INTERN_HASH_INIT, path);
+	struct intern_entry *entry = intern_find(&paths, hash, path_equals, path);
+	const char *copy;
+
 	if (!entry)
 		return NULL;
+	if (entry->data)
+		return entry->data;
 
-	memmove(paths + from + 1, paths + from, (paths_size - from) * sizeof(*paths));
-	paths[from] = entry;
-	paths_size++;
-
-	return entry;
+	copy = intern_strdup(path);
+	if (copy)
+		intern_add(&paths, entry, hash, copy);
+	return copy;
 }
 
-DEFINE_ALLOCATOR(realloc_authors, struct ident *, 256)
+static bool
+ident_equals(const void *data, const void *key)
+{
+	const struct ident *i1 = data, *i2 = key;
+
+	return !strcmp(i1->name, i2->name) && !strcmp(i1->email, i2->email);
+}
 
-/* Small author cache to reduce memory consumption. It uses binary
- * search to lookup or find place to position new entries. No entries
- * are ever freed. */
+/* Authors are identified by both their name and email. */
 static struct ident *
 get_author(const char *name, const char *email)
 {
-	static struct ident **authors;
-	static size_t authors_size;
-	int from = 0, to = authors_size - 1;
+	static struct intern_table authors;
+	struct ident key = { name, email };
+	unsigned int hash = intern_hash(intern_hash(INTERN_HASH_INIT, name), email);
+	struct intern_entry *entry = intern_find(&authors, hash, ident_equals, &key);
 	struct ident *ident;
 
-	while (from <= to) {
-		size_t pos = (to + from) / 2;
-		int cmp = strcmp(name, authors[pos]->name);
-
-		if (!cmp)
-			return authors[pos];
-
-		if (cmp < 0)
-			to = pos - 1;
-		else
-			from = pos + 1;
-	}
-
-	if (!realloc_authors(&authors, authors_size, 1))
+	if (!entry)
 		return NULL;
-	ident = calloc(1, sizeof(*ident));
+	if (entry->data)
+		return (struct ident *) entry->data;
+
+	ident = intern_alloc(sizeof(*ident));
 	if (!ident)
 		return NULL;
-	ident->name = strdup(name);
-	ident->email = strdup(email);
-	if (!ident->name || !ident->email) {
-		free((void *) ident->name);
-		free(ident);
+	memset(ident, 0, sizeof(*ident));
+	ident->name = intern_strdup(name);
+	ident->email = intern_strdup(email);
+	ident->initials = intern_strdup(get_author_initials(name));
+	ident->email_user = intern_strdup(get_email_user(email));
+	if (!ident->name || !ident->email || !ident->initials || !ident->email_user)
 		return NULL;
-	}
-
-	memmove(authors + from + 1, authors + from, (authors_size - from) * sizeof(*authors));
-	authors[from] = ident;
-	authors_size++;
 
+	intern_add(&authors, entry, hash, ident);
 	return ident;
 }
 
@@ -4198,9 +4991,6 @@ find_line_by_type(struct view *view, struct line *line, enum line_type type, int
 #define find_prev_line_by_type(view, line, type) \
 	find_line_by_type(view, line, type, -1)
 
-#define find_next_line_by_type(view, line, type) \
-	find_line_by_type(view, line, type, 1)
-
 /*
  * View history
  */
@@ -4377,16 +5167,202 @@ parse_blame_info(struct blame_commit *commit, char *line)
  * Pager backend
  */
 
+/*
+ * Text read from stdin by the pager view is spooled to a temporary file
+ * so memory use does not grow with the size of the input. Each line only
+ * keeps the offset of its NUL terminated text, which is read back one
+ * block at a time when the line is drawn or searched.
+ */
+
+#define PAGER_SPOOL_BLOCK	65536
+
+static struct pager_spool {
+	struct view *view;		/* The view using the spool, if any. */
+	FILE *file;
+	off_t size;			/* Bytes written to the spool. */
+	off_t flushed;			/* Bytes readable from the spool. */
+	char *block;			/* Buffer holding text read back. */
+	size_t blockalloc;
+	off_t blockpos;			/* Spool offset of the buffer. */
+	size_t blocksize;		/* Bytes read into the buffer. */
+} pager_spool;
+
+static void
+pager_spool_close(void)
+{
+	if (pager_spool.file)
+		fclose(pager_spool.file);
+	free(pager_spool.block);
+	memset(&pager_spool, 0, sizeof(pager_spool));
+}
+
+static bool
+pager_spool_open(struct view *view)
+{
+	pager_spool_close();
+	pager_spool.file = tmpfile();
+	if (!pager_spool.file)
+		return FALSE;
+	pager_spool.view = view;
+	return TRUE;
+}
+
+static bool
+pager_spool_read(off_t offset, size_t size)
+{
+	ssize_t readsize;
+
+	if (pager_spool.blockalloc < size) {
+		char *block = realloc(pager_spool.block, size);
+
+		if (!block)
+			return FALSE;
+		pager_spool.block = block;
+		pager_spool.blockalloc = size;
+	}
+
+	if (offset + size > pager_spool.flushed) {
+		if (fflush(pager_spool.file))
+			return FALSE;
+		pager_spool.flushed = pager_spool.size;
+	}
+
+	readsize = pread(fileno(pager_spool.file), pager_spool.block, size, offset);
+	pager_spool.blockpos = offset;
+	pager_spool.blocksize = MAX(readsize, 0);
+	return readsize > 0;
+}
+
+static const char *
+pager_spool_text(off_t offset)
+{
+	size_t size = PAGER_SPOOL_BLOCK;
+
+	if (offset < pager_spool.blockpos ||
+	    offset >= pager_spool.blockpos + pager_spool.blocksize ||
+	    !memchr(pager_spool.block + (offset - pager_spool.blockpos), 0,
+		    pager_spool.blocksize - (offset - pager_spool.blockpos))) {
+		/* Read blocks until the whole line fits. */
+		while (pager_spool_read(offset, size) &&
+		       !memchr(pager_spool.block, 0, pager_spool.blocksize)) {
+			if (pager_spool.blocksize < size)
+				return "";
+			size *= 2;
+		}
+
+		if (!pager_spool.blocksize)
+			return "";
+	}
+
+	return pager_spool.block + (offset - pager_spool.blockpos);
+}
+
+static struct line *
+pager_spool_add_line(struct view *view, const char *data, size_t datalen,
+		     enum line_type type)
+{
+	off_t offset = pager_spool.size;
+
+	if (fwrite(data, 1, datalen, pager_spool.file) != datalen ||
+	    putc(0, pager_spool.file) == EOF)
+		return NULL;
+	pager_spool.size += datalen + 1;
+
+	return add_line(view, &offset, type, sizeof(offset), FALSE);
+}
+
+static const char *
+pager_line_text(struct view *view, struct line *line)
+{
+	if (pager_spool.view == view)
+		return pager_spool_text(*(off_t *) line->data);
+	return line->data;
+}
+
+/*
+ * Wrapped lines are split into rows which all share the text of the
+ * first row. Only the number of rows is counted when a line is read or
+ * the view is resized; the part shown by a row is found when drawn.
+ */
+
+static size_t
+pager_wrap_length(const char *text, size_t textlen, size_t width, bool wrapped)
+{
+	size_t linelen = string_expanded_length(text, textlen, opt_tab_size, width - !!wrapped);
+
+	return linelen ? linelen : 1;
+}
+
+static size_t
+pager_wrap_rows(const char *text, size_t width)
+{
+	size_t textlen = strlen(text);
+	size_t rows = 1;
+
+	if (width <= 1 || !textlen)
+		return 1;
+
+	textlen -= pager_wrap_length(text, textlen, width, FALSE);
+	for (; textlen > 0; rows++) {
+		size_t linelen = pager_wrap_length(text, textlen, width, TRUE);
+
+		text += linelen;
+		textlen -= linelen;
+	}
+
+	return rows;
+}
+
+static const char *
+pager_wrap_text(struct view *view, struct line *line, const char *text)
+{
+	static char *buf;
+	static size_t bufsize;
+	struct line *row = line;
+	size_t textlen, linelen, rowlen;
+
+	if (!line->wrapped && (!view_has_line(view, line + 1) || !line[1].wrapped))
+		return text;
+
+	while (row->wrapped && row > view->line)
+		row--;
+
+	textlen = strlen(text);
+	linelen = pager_wrap_length(text, textlen, view->wrap_width, FALSE);
+	for (; row < line && linelen < textlen; row++) {
+		text += linelen;
+		textlen -= linelen;
+		linelen = pager_wrap_length(text, textlen, view->wrap_width, TRUE);
+	}
+
+	/* Rows of wide terminals can be longer than SIZEOF_STR. */
+	rowlen = MIN(linelen, textlen);
+	if (rowlen >= bufsize) {
+		char *tmp = realloc(buf, rowlen + 1);
+
+		if (!tmp)
+			return "";
+		buf = tmp;
+		bufsize = rowlen + 1;
+	}
+
+	memcpy(buf, text, rowlen);
+	buf[rowlen] = 0;
+	return buf;
+}
+
 static bool
 pager_draw(struct view *view, struct line *line, unsigned int lineno)
 {
+	const char *text = pager_wrap_text(view, line, pager_line_text(view, line));
+
 	if (draw_lineno(view, lineno))
 		return TRUE;
 
 	if (line->wrapped && draw_text(view, LINE_DELIMITER, "+"))
 		return TRUE;
 
-	draw_text(view, line->type, line->data);
+	draw_text(view, line->type, text);
 	return TRUE;
 }
 
@@ -4447,46 +5423,111 @@ try_add_describe_ref:
 	add_line_text(view, buf, LINE_PP_REFS);
 }
 
+static struct line *
+pager_add_line(struct view *view, const char *data, enum line_type type)
+{
+	if (pager_spool.view == view)
+		return pager_spool_add_line(view, data, strlen(data), type);
+	return add_line_text(view, data, type);
+}
+
 static struct line *
 pager_wrap_line(struct view *view, const char *data, enum line_type type)
 {
-	size_t first_line = 0;
-	bool has_first_line = FALSE;
-	size_t datalen = strlen(data);
-	size_t lineno = 0;
+	struct line *line = pager_add_line(view, data, type);
+	size_t first_line = view->lines - 1;
+	size_t rows = pager_wrap_rows(data, view->width);
 
-	while (datalen > 0 || !has_first_line) {
-		bool wrapped = !!first_line;
-		size_t linelen = string_expanded_length(data, datalen, opt_tab_size, view->width - !!wrapped);
-		struct line *line;
-		char *text;
+	if (!line)
+		return NULL;
 
-		line = add_line(view, NULL, type, linelen + 1, wrapped);
+	view->wrap_width = view->width;
+	while (--rows > 0) {
+		line = add_line(view, NULL, type, 0, TRUE);
 		if (!line)
-			break;
-		if (!has_first_line) {
-			first_line = view->lines - 1;
-			has_first_line = TRUE;
-		}
-
-		if (!wrapped)
-			lineno = line->lineno;
-
-		line->wrapped = wrapped;
-		line->lineno = lineno;
-		text = line->data;
-		if (linelen)
-			strncpy(text, data, linelen);
-		text[linelen] = 0;
+			return NULL;
 
-		datalen -= linelen;
-		data += linelen;
+		line->wrapped = 1;
+		line->lineno = view->line[first_line].lineno;
+		line->data = view->line[first_line].data;
 	}
 
-	return has_first_line ? &view->line[first_line] : NULL;
+	return &view->line[first_line];
 }
 
-static bool
+static size_t
+pager_line_rows(struct view *view, struct line *line, size_t width)
+{
+	return line->data ? pager_wrap_rows(pager_line_text(view, line), width) : 1;
+}
+
+/* Wrap the lines again when the view width changes or wrapping is
+ * toggled, keeping the text already read. */
+static void
+rewrap_view(struct view *view)
+{
+	size_t width = opt_wrap_lines ? view->width : 0;
+	unsigned long offset = 0, lineno = 0;
+	struct line *line = NULL;
+	size_t lines = 0, custom_lines = view->custom_lines;
+	size_t i, row, start;
+
+	if (!view_has_flags(view, VIEW_WRAP_LINES) || view->wrap_width == width)
+		return;
+
+	update_line_numbers(view);
+	for (i = 0; i < view->lines; i++) {
+		if (view->line[i].wrapped)
+			custom_lines--;
+		else
+			lines += pager_line_rows(view, &view->line[i], width);
+	}
+
+	if (lines && !realloc_lines(&line, 0, lines)) {
+		report("Allocation failure");
+		return;
+	}
+
+	reset_search_matches(view);
+
+	for (i = row = start = 0; i < view->lines; i++) {
+		struct line *first = &view->line[i];
+
+		if (!first->wrapped) {
+			size_t rows = pager_line_rows(view, first, width);
+
+			start = row;
+			line[row] = *first;
+			line[row++].dirty = 1;
+
+			for (custom_lines += rows - 1; rows > 1; rows--, row++) {
+				line[row] = *first;
+				line[row].wrapped = 1;
+				line[row].selected = 0;
+				line[row].user_flags = 0;
+			}
+		}
+
+		/* Keep the position at the start of its wrapped line. */
+		if (i == view->pos.offset)
+			offset = start;
+		if (i == view->pos.lineno)
+			lineno = start;
+	}
+
+	free(view->line);
+	view->line = line;
+	view->lines = lines;
+	view->custom_lines = custom_lines;
+	view->wrap_width = width;
+
+	view->pos.offset = offset;
+	view->pos.lineno = lineno;
+	if (view->pos.lineno >= view->pos.offset + view->height)
+		view->pos.offset = view->pos.lineno;
+}
+
+static bool
 pager_common_read(struct view *view, const char *data, enum line_type type)
 {
 	struct line *line;
@@ -4497,7 +5538,7 @@ pager_common_read(struct view *view, const char *data, enum line_type type)
 	if (opt_wrap_lines) {
 		line = pager_wrap_line(view, data, type);
 	} else {
-		line = add_line_text(view, data, type);
+		line = pager_add_line(view, data, type);
 	}
 
 	if (!line)
@@ -4548,16 +5589,17 @@ pager_request(struct view *view, enum request request, struct line *line)
 static bool
 pager_grep(struct view *view, struct line *line)
 {
-	const char *text[] = { line->data, NULL };
+	const char *text[] = { pager_line_text(view, line), NULL };
 
-	return grep_text(view, text);
+	/* Wrapped rows are searched as part of the first row. */
+	return !line->wrapped && grep_text(view, text);
 }
 
 static void
 pager_select(struct view *view, struct line *line)
 {
 	if (line->type == LINE_COMMIT) {
-		string_copy_rev_from_commit_line(ref_commit, line->data);
+		string_copy_rev_from_commit_line(ref_commit, pager_line_text(view, line));
 		if (!view_has_flags(view, VIEW_NO_REF))
 			string_copy_rev(view->ref, ref_commit);
 	}
@@ -4602,13 +5644,26 @@ pager_open(struct view *view, enum open_flags flags)
 		return FALSE;
 	}
 
-	return begin_update(view, NULL, NULL, flags);
+	if (!begin_update(view, NULL, NULL, flags))
+		return FALSE;
+
+	/* Fall back to keeping the text in memory. */
+	if (open_from_stdin(flags))
+		pager_spool_open(view);
+	return TRUE;
+}
+
+static void
+pager_done(struct view *view)
+{
+	if (pager_spool.view == view)
+		pager_spool_close();
 }
 
 static struct view_ops pager_ops = {
 	"line",
 	{ "pager" },
-	VIEW_OPEN_DIFF | VIEW_NO_REF | VIEW_NO_GIT_DIR,
+	VIEW_OPEN_DIFF | VIEW_NO_REF | VIEW_NO_GIT_DIR | VIEW_WRAP_LINES,
 	0,
 	pager_open,
 	pager_read,
@@ -4616,6 +5671,7 @@ static struct view_ops pager_ops = {
 	pager_request,
 	pager_grep,
 	pager_select,
+	pager_done,
 };
 
 static bool
@@ -4650,7 +5706,7 @@ log_request(struct view *view, enum request request, struct line *line)
 static struct view_ops log_ops = {
 	"line",
 	{ "log" },
-	VIEW_ADD_PAGER_REFS | VIEW_OPEN_DIFF | VIEW_SEND_CHILD_ENTER | VIEW_LOG_LIKE,
+	VIEW_ADD_PAGER_REFS | VIEW_OPEN_DIFF | VIEW_SEND_CHILD_ENTER | VIEW_LOG_LIKE | VIEW_WRAP_LINES,
 	sizeof(struct log_state),
 	log_open,
 	pager_read,
@@ -4660,14 +5716,110 @@ static struct view_ops log_ops = {
 	log_select,
 };
 
+struct chunk_header_position {
+	unsigned long position;
+	unsigned long lines;
+};
+
+struct chunk_header {
+	struct chunk_header_position old;
+	struct chunk_header_position new;
+};
+
+static bool
+parse_ulong(const char **pos_ptr, unsigned long *value, const char *skip)
+{
+	const char *start = *pos_ptr;
+	char *end;
+
+	if (!isdigit(*start))
+		return 0;
+
+	*value = strtoul(start, &end, 10);
+	if (end == start)
+		return FALSE;
+
+	start = end;
+	while (skip && *start && strchr(skip, *start))
+		start++;
+	*pos_ptr = start;
+	return TRUE;
+}
+
+static bool
+parse_chunk_header_position(const char **pos_ptr, struct chunk_header_position *position)
+{
+	if (!parse_ulong(pos_ptr, &position->position, NULL))
+		return FALSE;
+
+	/* The number of lines is left out when it is one. */
+	position->lines = 1;
+	if (**pos_ptr != ',')
+		return TRUE;
+
+	(*pos_ptr)++;
+	return parse_ulong(pos_ptr, &position->lines, NULL);
+}
+
+static bool
+parse_chunk_header(struct chunk_header *header, const char *line)
+{
+	memset(header, 0, sizeof(*header));
+
+	if (prefixcmp(line, "@@ -"))
+		return FALSE;
+
+	line += STRING_SIZE("@@ -");
+
+	if (!parse_chunk_header_position(&line, &header->old) ||
+	    prefixcmp(line, " +"))
+		return FALSE;
+
+	line += STRING_SIZE(" +");
+	return parse_chunk_header_position(&line, &header->new);
+}
+
+/* Where line numbers in a diff can be counted from. */
+struct diff_mark {
+	size_t lineno;		/* Line of the mark. */
+	size_t header;		/* Line of the diff header. */
+	size_t chunk;		/* Line of the chunk header, 0 outside chunks. */
+	unsigned long old;	/* Old line number of the marked line. */
+	unsigned long new;	/* New line number of the marked line. */
+};
+
+/* Marks are added at diff headers, chunk headers and every so many
+ * lines of a chunk, so any line can be looked up without walking the
+ * view. */
+#define DIFF_MARK_LINES	256
+
+/* The index is freed using diff_index_free() when the view is done. */
+struct diff_index {
+	size_t lines;			/* Number of lines indexed. */
+	size_t wrap_width;		/* Wrap width of the indexed lines. */
+	struct diff_mark pos;		/* Position of the next line. */
+	bool file_header;		/* Reading the header of a file diff. */
+	struct diff_mark *mark;
+	size_t marks;
+	size_t *file;			/* Diff headers of the file diffs. */
+	size_t files;
+	size_t *chunk;			/* Chunk headers. */
+	size_t chunks;
+};
+
 struct diff_state {
 	bool after_commit_title;
 	bool after_diff;
 	bool reading_diff_stat;
 	bool combined_diff;
+	unsigned long chunk_old; /* Old lines left in the chunk being read. */
+	unsigned long chunk_new; /* New lines left in the chunk being read. */
+	struct diff_index index;
+	size_t goto_file;	/* File diff to select once read, if set. */
 };
 
 #define DIFF_LINE_COMMIT_TITLE 1
+#define DIFF_LINE_QUEUED	2
 
 static bool
 diff_open(struct view *view, enum open_flags flags)
@@ -4679,13 +5831,95 @@ diff_open(struct view *view, enum open_flags flags)
 			"%(diffargs)", "--no-color", "%(commit)", "--", "%(fileargs)", NULL
 	};
 
-	return begin_update(view, NULL, diff_argv, flags);
+	if (!begin_update(view, NULL, diff_argv, flags))
+		return FALSE;
+
+	/* Make sure the previous position can be restored. */
+	if (view->pipe) {
+		view->max_lines = 0;
+		if (opt_diff_view_page_size)
+			view->max_lines = view->prev_pos.lineno + view->height + opt_diff_view_page_size;
+	}
+	return TRUE;
+}
+
+/* Lines inside a chunk are classified by their first character while
+ * counting down the lines left in the chunk, so nothing else of the
+ * line needs to be looked at. */
+static bool
+diff_read_chunk_line(struct diff_state *state, const char *data, enum line_type *type)
+{
+	switch (*data) {
+	case '+':
+		if (!state->chunk_new)
+			break;
+		state->chunk_new--;
+		*type = LINE_DIFF_ADD;
+		return TRUE;
+
+	case '-':
+		if (!state->chunk_old)
+			break;
+		state->chunk_old--;
+		*type = LINE_DIFF_DEL;
+		return TRUE;
+
+	case ' ':
+		if (!state->chunk_old || !state->chunk_new)
+			break;
+		state->chunk_old--;
+		state->chunk_new--;
+		*type = LINE_DEFAULT;
+		return TRUE;
+
+	case '\\':
+		*type = LINE_DEFAULT;
+		return TRUE;
+	}
+
+	state->chunk_old = state->chunk_new = 0;
+	return FALSE;
+}
+
+/* Diff stat lines have a histogram after the pipe, unless only the file
+ * mode changed or the file was renamed or is binary. */
+static bool
+diff_read_stat_line(struct view *view, const char *data)
+{
+	const char *pipe = strchr(data, '|');
+	char last;
+
+	if (!pipe)
+		return FALSE;
+
+	last = pipe[strlen(pipe) - 1];
+	if (last != '-' && last != '+' &&
+	    !strstr(pipe, " 0") &&
+	    !(strstr(pipe, "Bin") && strstr(pipe, "->")) &&
+	    !(last == '0' && (strstr(data, "=>") || !strncmp(data, " ...", 4))))
+		return FALSE;
+
+	return add_line_text(view, data, LINE_DIFF_STAT) != NULL;
 }
 
 static bool
 diff_common_read(struct view *view, const char *data, struct diff_state *state)
 {
-	enum line_type type = get_line_type(data);
+	enum line_type type;
+
+	if ((state->chunk_old || state->chunk_new) &&
+	    diff_read_chunk_line(state, data, &type)) {
+		/* Custom colors may have rules matching the line. */
+		if (custom_colors) {
+			enum line_type custom = get_line_type(data);
+
+			if (custom > LINE_NONE)
+				type = custom;
+		}
+		return pager_common_read(view, data, type);
+	}
+
+	type = get_line_type(data);
 
 	if (!view->lines && type != LINE_COMMIT)
 		state->reading_diff_stat = TRUE;
@@ -4694,18 +5928,9 @@ diff_common_read(struct view *view, const char *data, struct diff_state *state)
 		state->reading_diff_stat = TRUE;
 
 	if (state->reading_diff_stat) {
-		size_t len = strlen(data);
-		char *pipe = strchr(data, '|');
-		bool has_histogram = data[len - 1] == '-' || data[len - 1] == '+';
-		bool has_bin_diff = pipe && strstr(pipe, "Bin") && strstr(pipe, "->");
-		bool has_rename = data[len - 1] == '0' && (strstr(data, "=>") || !strncmp(data, " ...", 4));
-		bool has_no_change = pipe && strstr(pipe, " 0");
-
-		if (pipe && (has_histogram || has_bin_diff || has_rename || has_no_change)) {
-			return add_line_text(view, data, LINE_DIFF_STAT) != NULL;
-		} else {
-			state->reading_diff_stat = FALSE;
-		}
+		if (diff_read_stat_line(view, data))
+			return TRUE;
+		state->reading_diff_stat = FALSE;
 
 	} else if (!strcmp(data, "---")) {
 		state->reading_diff_stat = TRUE;
@@ -4730,6 +5955,16 @@ diff_common_read(struct view *view, const char *data, struct diff_state *state)
 
 	} else if (type == LINE_PP_MERGE) {
 		state->combined_diff = TRUE;
+
+	} else if (type == LINE_DIFF_CHUNK && !state->combined_diff) {
+		struct chunk_header header;
+
+		if (parse_chunk_header(&header, data)) {
+			state->chunk_old = header.old.lines;
+			state->chunk_new = header.new.lines;
+		} else {
+			state->chunk_old = state->chunk_new = 0;
+		}
 	}
 
 	/* ADD2 and DEL2 are only valid in combined diff hunks */
@@ -4739,46 +5974,196 @@ diff_common_read(struct view *view, const char *data, struct diff_state *state)
 	return pager_common_read(view, data, type);
 }
 
+static void
+diff_index_reset(struct diff_index *index)
+{
+	index->lines = index->marks = index->files = index->chunks = 0;
+	index->file_header = FALSE;
+	memset(&index->pos, 0, sizeof(index->pos));
+}
+
+static void
+diff_index_free(struct diff_index *index)
+{
+	free(index->mark);
+	free(index->file);
+	free(index->chunk);
+	memset(index, 0, sizeof(*index));
+}
+
+DEFINE_ALLOCATOR(realloc_diff_marks, struct diff_mark, 256)
+DEFINE_ALLOCATOR(realloc_diff_lines, size_t, 256)
+
 static bool
-diff_find_stat_entry(struct view *view, struct line *line, enum line_type type)
+diff_index_mark(struct diff_index *index, size_t lineno)
 {
-	struct line *marker = find_next_line_by_type(view, line, type);
+	if (!realloc_diff_marks(&index->mark, index->marks, 1))
+		return FALSE;
 
-	return marker &&
-		line == find_prev_line_by_type(view, marker, LINE_DIFF_HEADER);
+	index->pos.lineno = lineno;
+	index->mark[index->marks++] = index->pos;
+	return TRUE;
+}
+
+static void
+diff_mark_count(struct diff_mark *pos, const char *data)
+{
+	if (*data == '+' || *data == ' ')
+		pos->new++;
+	if (*data == '-' || *data == ' ')
+		pos->old++;
+}
+
+/* Index the lines added since the last update. */
+static bool
+diff_index_update(struct view *view, struct diff_state *state)
+{
+	struct diff_index *index = &state->index;
+	struct diff_mark *pos = &index->pos;
+
+	/* Wrapping the view again moves the lines. */
+	if (index->wrap_width != view->wrap_width) {
+		index->wrap_width = view->wrap_width;
+		diff_index_reset(index);
+	}
+
+	for (; index->lines < view->lines; index->lines++) {
+		size_t lineno = index->lines;
+		struct line *line = &view->line[lineno];
+
+		if (line->wrapped)
+			continue;
+
+		if (line->type == LINE_DIFF_HEADER) {
+			pos->header = lineno;
+			pos->chunk = 0;
+			index->file_header = TRUE;
+			if (!diff_index_mark(index, lineno))
+				return FALSE;
+
+		} else if (!index->marks) {
+			continue;
+
+		} else if (index->file_header &&
+			   (line->type == LINE_DIFF_INDEX || line->type == LINE_DIFF_SIMILARITY)) {
+			index->file_header = FALSE;
+			if (!realloc_diff_lines(&index->file, index->files, 1))
+				return FALSE;
+			index->file[index->files++] = pos->header;
+
+		} else if (line->type == LINE_DIFF_CHUNK) {
+			struct chunk_header header;
+
+			parse_chunk_header(&header, line->data);
+			pos->chunk = lineno;
+			pos->old = header.old.position;
+			pos->new = header.new.position;
+			if (!realloc_diff_lines(&index->chunk, index->chunks, 1) ||
+			    !diff_index_mark(index, lineno))
+				return FALSE;
+			index->chunk[index->chunks++] = lineno;
+
+		} else if (pos->chunk) {
+			if (lineno - index->mark[index->marks - 1].lineno >= DIFF_MARK_LINES &&
+			    !diff_index_mark(index, lineno))
+				return FALSE;
+			diff_mark_count(pos, line->data);
+		}
+	}
+
+	return TRUE;
+}
+
+/* Find the last mark at or above the line. */
+static const struct diff_mark *
+diff_index_find(struct view *view, struct line *line)
+{
+	struct diff_state *state = view->private;
+	struct diff_index *index = &state->index;
+	size_t lineno = line - view->line;
+	size_t low = 0, high;
+
+	if (!diff_index_update(view, state))
+		return NULL;
+
+	high = index->marks;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if (index->mark[mid].lineno <= lineno)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low ? &index->mark[low - 1] : NULL;
+}
+
+/* Get the diff header, chunk and line numbers of the line, counting
+ * from the closest mark. */
+static bool
+diff_get_position(struct view *view, struct line *line, struct diff_mark *pos)
+{
+	const struct diff_mark *mark;
+	struct line *row;
+
+	while (line->wrapped && line > view->line)
+		line--;
+
+	mark = diff_index_find(view, line);
+	if (!mark)
+		return FALSE;
+
+	*pos = *mark;
+	pos->lineno = line - view->line;
+	if (pos->chunk)
+		for (row = view->line + mark->lineno; row < line; row++)
+			if (!row->wrapped)
+				diff_mark_count(pos, row->data);
+
+	return TRUE;
+}
+
+static struct line *
+diff_find_chunk(struct view *view, struct line *line)
+{
+	const struct diff_mark *mark = diff_index_find(view, line);
+
+	return mark && mark->chunk ? view->line + mark->chunk : NULL;
 }
 
 static enum request
 diff_common_enter(struct view *view, enum request request, struct line *line)
 {
 	if (line->type == LINE_DIFF_STAT) {
+		struct diff_state *state = view->private;
 		int file_number = 0;
 
 		while (view_has_line(view, line) && line->type == LINE_DIFF_STAT) {
-			file_number++;
+			if (!line->wrapped)
+				file_number++;
 			line--;
 		}
 
-		for (line = view->line; view_has_line(view, line); line++) {
-			line = find_next_line_by_type(view, line, LINE_DIFF_HEADER);
-			if (!line)
-				break;
+		if (!diff_index_update(view, state)) {
+			report("Allocation failure");
+			return REQ_NONE;
+		}
 
-			if (diff_find_stat_entry(view, line, LINE_DIFF_INDEX)
-			    || diff_find_stat_entry(view, line, LINE_DIFF_SIMILARITY)) {
-				if (file_number == 1) {
-					break;
-				}
-				file_number--;
-			}
+		/* Read on until the file diff has been loaded. */
+		if (view->pipe && view->max_lines && file_number > state->index.files) {
+			state->goto_file = file_number;
+			view->max_lines = 0;
+			report("Loading file diff %d", file_number);
+			return REQ_NONE;
 		}
 
-		if (!line) {
+		if (file_number > state->index.files) {
 			report("Failed to find file diff");
 			return REQ_NONE;
 		}
 
-		select_view_line(view, line - view->line);
+		select_view_line(view, state->index.file[file_number - 1]);
 		report_clear();
 		return REQ_NONE;
 
@@ -4806,12 +6191,18 @@ diff_common_draw_part(struct view *view, enum line_type *type, char **text, char
 static bool
 diff_common_draw(struct view *view, struct line *line, unsigned int lineno)
 {
-	char *text = line->data;
+	char *text = (char *) pager_wrap_text(view, line, line->data);
 	enum line_type type = line->type;
+	struct line *first = line;
 
 	if (draw_lineno(view, lineno))
 		return TRUE;
 
+	while (first->wrapped && first > view->line)
+		first--;
+	if (first->user_flags & DIFF_LINE_QUEUED)
+		type = LINE_STAT_QUEUED;
+
 	if (line->wrapped && draw_text(view, LINE_DELIMITER, "+"))
 		return TRUE;
 
@@ -4837,6 +6228,32 @@ diff_common_draw(struct view *view, struct line *line, unsigned int lineno)
 	return TRUE;
 }
 
+/* Index the file diffs as they are read while loading is paused at a
+ * page below the screen, to select a file diff from the diff stat once
+ * read. */
+static bool
+diff_read_file(struct view *view, struct diff_state *state)
+{
+	if (!diff_index_update(view, state))
+		return FALSE;
+
+	if (state->goto_file && state->goto_file <= state->index.files) {
+		size_t lineno = state->index.file[state->goto_file - 1];
+
+		state->goto_file = 0;
+		if (opt_diff_view_page_size)
+			view->max_lines = lineno + view->height + opt_diff_view_page_size;
+		select_view_line(view, lineno);
+		report_clear();
+	}
+
+	/* Do not pause reading before the diff stat is complete. */
+	if (view->max_lines && !state->after_diff && view->lines + 1 >= view->max_lines)
+		view->max_lines += opt_diff_view_page_size;
+
+	return TRUE;
+}
+
 static bool
 diff_read(struct view *view, char *data)
 {
@@ -4863,7 +6280,10 @@ diff_read(struct view *view, char *data)
 		return TRUE;
 	}
 
-	return diff_common_read(view, data, state);
+	if (!diff_common_read(view, data, state))
+		return FALSE;
+
+	return diff_read_file(view, state);
 }
 
 static bool
@@ -4903,80 +6323,25 @@ diff_blame_line(const char *ref, const char *file, unsigned long lineno,
 	return ok;
 }
 
-struct chunk_header_position {
-	unsigned long position;
-	unsigned long lines;
-};
-
-struct chunk_header {
-	struct chunk_header_position old;
-	struct chunk_header_position new;
-};
-
-static bool
-parse_ulong(const char **pos_ptr, unsigned long *value, const char *skip)
-{
-	const char *start = *pos_ptr;
-	char *end;
-
-	if (!isdigit(*start))
-		return 0;
-
-	*value = strtoul(start, &end, 10);
-	if (end == start)
-		return FALSE;
-
-	start = end;
-	while (skip && *start && strchr(skip, *start))
-		start++;
-	*pos_ptr = start;
-	return TRUE;
-}
-
-static bool
-parse_chunk_header(struct chunk_header *header, const char *line)
-{
-	memset(header, 0, sizeof(*header));
-
-	if (prefixcmp(line, "@@ -"))
-		return FALSE;
-
-	line += STRING_SIZE("@@ -");
-
-	return  parse_ulong(&line, &header->old.position, ",") &&
-		parse_ulong(&line, &header->old.lines, " +") &&
-		parse_ulong(&line, &header->new.position, ",") &&
-		parse_ulong(&line, &header->new.lines, NULL);
-}
-
 static unsigned int
 diff_get_lineno(struct view *view, struct line *line)
 {
-	const struct line *header, *chunk;
-	unsigned int lineno;
+	struct diff_mark pos;
 	struct chunk_header chunk_header;
 
 	/* Verify that we are after a diff header and one of its chunks */
-	header = find_prev_line_by_type(view, line, LINE_DIFF_HEADER);
-	chunk = find_prev_line_by_type(view, line, LINE_DIFF_CHUNK);
-	if (!header || !chunk || chunk < header)
+	if (!diff_get_position(view, line, &pos) || !pos.chunk)
 		return 0;
 
 	/*
 	 * In a chunk header, the number after the '+' sign is the number of its
-	 * following line, in the new version of the file. We increment this
-	 * number for each non-deletion line, until the given line position.
+	 * following line, in the new version of the file. The index counts
+	 * this number for each non-deletion line, until the given line position.
 	 */
-	if (!parse_chunk_header(&chunk_header, chunk->data))
+	if (!parse_chunk_header(&chunk_header, view->line[pos.chunk].data))
 		return 0;
 
-	lineno = chunk_header.new.position;
-	chunk++;
-	while (chunk++ < line)
-		if (chunk->type != LINE_DIFF_DEL)
-			lineno++;
-
-	return lineno;
+	return pos.new;
 }
 
 static bool
@@ -4996,8 +6361,8 @@ parse_chunk_lineno(unsigned long *lineno, const char *chunk, int marker)
 static enum request
 diff_trace_origin(struct view *view, struct line *line)
 {
-	struct line *diff = find_prev_line_by_type(view, line, LINE_DIFF_HEADER);
-	struct line *chunk = find_prev_line_by_type(view, line, LINE_DIFF_CHUNK);
+	struct diff_mark pos;
+	struct line *diff, *chunk;
 	const char *chunk_data;
 	int chunk_marker = line->type == LINE_DIFF_DEL ? '-' : '+';
 	unsigned long lineno = 0;
@@ -5006,11 +6371,14 @@ diff_trace_origin(struct view *view, struct line *line)
 	struct blame_header header;
 	struct blame_commit commit;
 
-	if (!diff || !chunk || chunk == line) {
+	if (!diff_get_position(view, line, &pos) || !pos.chunk || pos.chunk == pos.lineno) {
 		report("The line to trace must be inside a diff chunk");
 		return REQ_NONE;
 	}
 
+	diff = view->line + pos.header;
+	chunk = view->line + pos.chunk;
+
 	for (; diff < line && !file; diff++) {
 		const char *data = diff->data;
 
@@ -5037,15 +6405,7 @@ diff_trace_origin(struct view *view, struct line *line)
 		return REQ_NONE;
 	}
 
-	for (chunk += 1; chunk < line; chunk++) {
-		if (chunk->type == LINE_DIFF_ADD) {
-			lineno += chunk_marker == '+';
-		} else if (chunk->type == LINE_DIFF_DEL) {
-			lineno += chunk_marker == '-';
-		} else {
-			lineno++;
-		}
-	}
+	lineno = chunk_marker == '-' ? pos.old : pos.new;
 
 	if (chunk_marker == '+')
 		string_copy(ref, view->vid);
@@ -5067,17 +6427,16 @@ diff_trace_origin(struct view *view, struct line *line)
 static const char *
 diff_get_pathname(struct view *view, struct line *line)
 {
-	const struct line *header;
+	const struct diff_mark *mark = diff_index_find(view, line);
 	const char *dst = NULL;
 	const char *prefixes[] = { " b/", "cc ", "combined " };
 	int i;
 
-	header = find_prev_line_by_type(view, line, LINE_DIFF_HEADER);
-	if (!header)
+	if (!mark)
 		return NULL;
 
 	for (i = 0; i < ARRAY_SIZE(prefixes) && !dst; i++)
-		dst = strstr(header->data, prefixes[i]);
+		dst = strstr(view->line[mark->header].data, prefixes[i]);
 
 	return dst ? dst + strlen(prefixes[--i]) : NULL;
 }
@@ -5134,6 +6493,12 @@ diff_request(struct view *view, enum request request, struct line *line)
 static void
 diff_select(struct view *view, struct line *line)
 {
+	size_t lineno = line - view->line;
+
+	/* Load the next page when getting within a screen of the end. */
+	if (view->max_lines && lineno + view->height >= view->max_lines)
+		view->max_lines = lineno + view->height + opt_diff_view_page_size;
+
 	if (line->type == LINE_DIFF_STAT) {
 		string_format(view->ref, "Press '%s' to jump to file diff",
 			      get_view_key(view, REQ_ENTER));
@@ -5151,10 +6516,18 @@ diff_select(struct view *view, struct line *line)
 	}
 }
 
+static void
+diff_done(struct view *view)
+{
+	struct diff_state *state = view->private;
+
+	diff_index_free(&state->index);
+}
+
 static struct view_ops diff_ops = {
 	"line",
 	{ "diff" },
-	VIEW_DIFF_LIKE | VIEW_ADD_DESCRIBE_REF | VIEW_ADD_PAGER_REFS | VIEW_FILE_FILTER,
+	VIEW_DIFF_LIKE | VIEW_ADD_DESCRIBE_REF | VIEW_ADD_PAGER_REFS | VIEW_FILE_FILTER | VIEW_WRAP_LINES,
 	sizeof(struct diff_state),
 	diff_open,
 	diff_read,
@@ -5162,6 +6535,7 @@ static struct view_ops diff_ops = {
 	diff_request,
 	pager_grep,
 	diff_select,
+	diff_done,
 };
 
 /*
@@ -5447,6 +6821,31 @@ tree_entry(struct view *view, enum line_type type, const char *path,
 	return line;
 }
 
+static int
+tree_compare_line(const void *l1, const void *l2)
+{
+	return tree_compare_entry(l1, l2);
+}
+
+/* Sort the entries once they have all been read instead of inserting
+ * each entry at its place while reading. */
+static void
+tree_sort_entries(struct view *view)
+{
+	/* Skip "Directory ..." and ".." line. */
+	size_t first = 1 + !!*opt_path;
+	size_t i;
+
+	if (view->lines <= first)
+		return;
+
+	qsort(view->line + first, view->lines - first, sizeof(*view->line), tree_compare_line);
+	for (i = first; i < view->lines; i++) {
+		view->line[i].lineno = i + 1 - view->custom_lines;
+		view->line[i].dirty = view->line[i].cleareol = 1;
+	}
+}
+
 static bool
 tree_read_date(struct view *view, char *text, struct tree_state *state)
 {
@@ -5468,6 +6867,8 @@ tree_read_date(struct view *view, char *text, struct tree_state *state)
 			return TRUE;
 		}
 
+		tree_sort_entries(view);
+
 		if (!begin_update(view, opt_cdup, log_file, OPEN_EXTRA)) {
 			report("Failed to load tree data");
 			return TRUE;
@@ -5543,8 +6944,7 @@ static bool
 tree_read(struct view *view, char *text)
 {
 	struct tree_state *state = view->private;
-	struct tree_entry *data;
-	struct line *entry, *line;
+	struct line *entry;
 	enum line_type type;
 	size_t textlen = text ? strlen(text) : 0;
 	const char *attr_offset = text + SIZEOF_TREE_ATTR;
@@ -5585,21 +6985,6 @@ tree_read(struct view *view, char *text)
 	entry = tree_entry(view, type, path, text, text + TREE_ID_OFFSET, size);
 	if (!entry)
 		return FALSE;
-	data = entry->data;
-
-	/* Skip "Directory ..." and ".." line. */
-	for (line = &view->line[1 + !!*opt_path]; line < entry; line++) {
-		if (tree_compare_entry(line, entry) <= 0)
-			continue;
-
-		memmove(line + 1, line, (entry - line) * sizeof(*entry));
-
-		line->data = data;
-		line->type = type;
-		for (; line <= entry; line++)
-			line->dirty = line->cleareol = 1;
-		return TRUE;
-	}
 
 	/* Move the current line to the first tree entry. */
 	if (!check_position(&view->prev_pos) && !check_position(&view->pos))
@@ -6678,8 +8063,6 @@ static char status_onbranch[SIZEOF_STR];
 static struct status stage_status;
 static enum line_type stage_line_type;
 
-DEFINE_ALLOCATOR(realloc_ints, int, 32)
-
 /* This should work even for the "On branch" line. */
 static inline bool
 status_has_none(struct view *view, struct line *line)
@@ -7390,20 +8773,21 @@ static struct view_ops status_ops = {
 
 struct stage_state {
 	struct diff_state diff;
-	size_t chunks;
-	int *chunk;
+	size_t queued;		/* Number of lines queued for update. */
 };
 
 static bool
 stage_diff_write(struct io *io, struct line *line, struct line *end)
 {
 	while (line < end) {
-		if (!io_write(io, line->data, strlen(line->data)) ||
-		    !io_write(io, "\n", 1))
+		if (!line->wrapped &&
+		    (!io_write(io, line->data, strlen(line->data)) ||
+		     !io_write(io, "\n", 1)))
 			return FALSE;
 		line++;
-		if (line->type == LINE_DIFF_CHUNK ||
-		    line->type == LINE_DIFF_HEADER)
+		if (!line->wrapped &&
+		    (line->type == LINE_DIFF_CHUNK ||
+		     line->type == LINE_DIFF_HEADER))
 			break;
 	}
 
@@ -7416,13 +8800,14 @@ stage_apply_chunk(struct view *view, struct line *chunk, struct line *line, bool
 	const char *apply_argv[SIZEOF_ARG] = {
 		"git", "apply", "--whitespace=nowarn", NULL
 	};
+	const struct diff_mark *mark = diff_index_find(view, chunk);
 	struct line *diff_hdr;
 	struct io io;
 	int argc = 3;
 
-	diff_hdr = find_prev_line_by_type(view, chunk, LINE_DIFF_HEADER);
-	if (!diff_hdr)
+	if (!mark)
 		return FALSE;
+	diff_hdr = view->line + mark->header;
 
 	if (!revert)
 		apply_argv[argc++] = "--cached";
@@ -7435,6 +8820,10 @@ stage_apply_chunk(struct view *view, struct line *chunk, struct line *line, bool
 	if (!io_run(&io, IO_WR, opt_cdup, opt_env, apply_argv))
 		return FALSE;
 
+	/* Stage the whole line when one of its wrapped rows is selected. */
+	while (line && line->wrapped && line > chunk)
+		line--;
+
 	if (line != NULL) {
 		unsigned long lineno = 0;
 		struct line *context = chunk + 1;
@@ -7446,7 +8835,9 @@ stage_apply_chunk(struct view *view, struct line *chunk, struct line *line, bool
 		parse_chunk_lineno(&lineno, chunk->data, line->type == LINE_DIFF_DEL ? '+' : '-');
 
 		while (context < line) {
-			if (context->type == LINE_DIFF_CHUNK || context->type == LINE_DIFF_HEADER) {
+			if (context->wrapped) {
+				/* Wrapped rows are not counted. */
+			} else if (context->type == LINE_DIFF_CHUNK || context->type == LINE_DIFF_HEADER) {
 				break;
 			} else if (context->type != LINE_DIFF_DEL && context->type != LINE_DIFF_ADD) {
 				lineno++;
@@ -7468,94 +8859,461 @@ stage_apply_chunk(struct view *view, struct line *chunk, struct line *line, bool
 
 	io_done(&io);
 
-	return chunk ? TRUE : FALSE;
+	return chunk ? TRUE : FALSE;
+}
+
+static bool
+stage_update(struct view *view, struct line *line, bool single)
+{
+	struct line *chunk = NULL;
+
+	if (!is_initial_commit() && stage_line_type != LINE_STAT_UNTRACKED)
+		chunk = diff_find_chunk(view, line);
+
+	if (chunk) {
+		if (!stage_apply_chunk(view, chunk, single ? line : NULL, FALSE)) {
+			report("Failed to apply chunk");
+			return FALSE;
+		}
+
+	} else if (!stage_status.status) {
+		view = view->parent;
+
+		for (line = view->line; view_has_line(view, line); line++)
+			if (line->type == stage_line_type)
+				break;
+
+		if (!status_update_files(view, line + 1)) {
+			report("Failed to update files");
+			return FALSE;
+		}
+
+	} else if (!status_update_file(&stage_status, stage_line_type)) {
+		report("Failed to update file");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static bool
+stage_revert(struct view *view, struct line *line)
+{
+	struct line *chunk = NULL;
+
+	if (!is_initial_commit() && stage_line_type == LINE_STAT_UNSTAGED)
+		chunk = diff_find_chunk(view, line);
+
+	if (chunk) {
+		if (!prompt_yesno("Are you sure you want to revert changes?"))
+			return FALSE;
+
+		if (!stage_apply_chunk(view, chunk, NULL, TRUE)) {
+			report("Failed to revert chunk");
+			return FALSE;
+		}
+		return TRUE;
+
+	} else {
+		return status_revert(stage_status.status ? &stage_status : NULL,
+				     stage_line_type, FALSE);
+	}
+}
+
+/*
+ * Changes are queued line by line and applied together by writing a
+ * single patch for all of them. Changes that are not queued are left
+ * out of the patch, or become context when they are in the version the
+ * patch is applied to: the index for unstaged changes and, since the
+ * patch is reversed, the new version for staged changes.
+ */
+
+static char
+stage_queue_keep(void)
+{
+	return stage_line_type == LINE_STAT_STAGED ? '+' : '-';
+}
+
+static bool
+stage_is_change(struct line *line)
+{
+	const char *data = line->data;
+
+	return *data == '+' || *data == '-';
+}
+
+/* Get the line after the last line of the chunk. */
+static struct line *
+stage_chunk_end(struct view *view, struct line *chunk)
+{
+	struct line *line = chunk + 1;
+
+	while (view_has_line(view, line) &&
+	       (line->wrapped ||
+		(line->type != LINE_DIFF_CHUNK && line->type != LINE_DIFF_HEADER)))
+		line++;
+
+	return line;
+}
+
+/* Keep the line numbers of one side of the chunk, and move the other
+ * side by the number of lines added before the chunk. */
+static void
+stage_move_chunk(struct chunk_header *header, char keep, long delta,
+		 unsigned long old_lines, unsigned long new_lines)
+{
+	unsigned long old = header->old.position + !header->old.lines;
+	unsigned long new = header->new.position + !header->new.lines;
+
+	if (keep == '-')
+		new = old + delta;
+	else
+		old = new - delta;
+
+	/* The position is the line before the chunk when it is empty. */
+	header->old.position = old - !old_lines;
+	header->old.lines = old_lines;
+	header->new.position = new - !new_lines;
+	header->new.lines = new_lines;
+}
+
+static void
+stage_queue_line(struct view *view, struct line *line, bool queue)
+{
+	struct stage_state *state = view->private;
+
+	if (!(line->user_flags & DIFF_LINE_QUEUED) == !queue)
+		return;
+
+	if (queue) {
+		line->user_flags |= DIFF_LINE_QUEUED;
+		state->queued++;
+	} else {
+		line->user_flags &= ~DIFF_LINE_QUEUED;
+		state->queued--;
+	}
+
+	do {
+		line->dirty = 1;
+		line++;
+	} while (view_has_line(view, line) && line->wrapped);
+}
+
+static void
+stage_queue(struct view *view, struct line *line)
+{
+	struct stage_state *state = view->private;
+	struct line *chunk, *end, *pos;
+	bool queue = FALSE;
+
+	while (line->wrapped && line > view->line)
+		line--;
+
+	chunk = diff_find_chunk(view, line);
+	if (!chunk) {
+		report("No chunks to queue in sight");
+		return;
+	}
+
+	if (line != chunk && stage_is_change(line)) {
+		stage_queue_line(view, line, !(line->user_flags & DIFF_LINE_QUEUED));
+
+	} else {
+		/* Queue the chunk unless all of its changes are queued. */
+		end = stage_chunk_end(view, chunk);
+		for (pos = chunk + 1; pos < end; pos++)
+			if (!pos->wrapped && stage_is_change(pos) &&
+			    !(pos->user_flags & DIFF_LINE_QUEUED))
+				queue = TRUE;
+
+		for (pos = chunk + 1; pos < end; pos++)
+			if (!pos->wrapped && stage_is_change(pos))
+				stage_queue_line(view, pos, queue);
+	}
+
+	redraw_view_dirty(view);
+	if (state->queued)
+		report("%zd lines queued, press %s to update them", state->queued,
+		       get_view_key(view, REQ_STATUS_UPDATE));
+	else
+		report("No lines queued");
+}
+
+/* Get the marker of the line in the patch, or 0 to leave it out. */
+static char
+stage_queue_marker(struct line *line, char keep)
+{
+	const char *data = line->data;
+
+	if (!stage_is_change(line) || (line->user_flags & DIFF_LINE_QUEUED))
+		return *data;
+	return *data == keep ? ' ' : 0;
 }
 
 static bool
-stage_update(struct view *view, struct line *line, bool single)
+stage_write_queue(struct view *view, struct io *io)
 {
-	struct line *chunk = NULL;
+	struct stage_state *state = view->private;
+	struct diff_index *index = &state->diff.index;
+	struct line *diff_hdr = NULL;
+	char keep = stage_queue_keep();
+	long delta = 0;
+	size_t i;
 
-	if (!is_initial_commit() && stage_line_type != LINE_STAT_UNTRACKED)
-		chunk = find_prev_line_by_type(view, line, LINE_DIFF_CHUNK);
+	if (!diff_index_update(view, &state->diff))
+		return FALSE;
 
-	if (chunk) {
-		if (!stage_apply_chunk(view, chunk, single ? line : NULL, FALSE)) {
-			report("Failed to apply chunk");
-			return FALSE;
+	for (i = 0; i < index->chunks; i++) {
+		struct line *chunk = view->line + index->chunk[i];
+		struct line *end = stage_chunk_end(view, chunk);
+		const struct diff_mark *mark = diff_index_find(view, chunk);
+		unsigned long old_lines = 0, new_lines = 0;
+		struct chunk_header header;
+		bool queued = FALSE, written = FALSE;
+		struct line *line;
+
+		for (line = chunk + 1; line < end; line++) {
+			char marker = stage_queue_marker(line, keep);
+
+			if (line->wrapped)
+				continue;
+			if (line->user_flags & DIFF_LINE_QUEUED)
+				queued = TRUE;
+			old_lines += marker == ' ' || marker == '-';
+			new_lines += marker == ' ' || marker == '+';
 		}
 
-	} else if (!stage_status.status) {
-		view = view->parent;
+		if (!queued)
+			continue;
 
-		for (line = view->line; view_has_line(view, line); line++)
-			if (line->type == stage_line_type)
-				break;
+		if (!mark || !parse_chunk_header(&header, chunk->data))
+			return FALSE;
 
-		if (!status_update_files(view, line + 1)) {
-			report("Failed to update files");
+		if (diff_hdr != view->line + mark->header) {
+			diff_hdr = view->line + mark->header;
+			if (!stage_diff_write(io, diff_hdr, chunk))
+				return FALSE;
+		}
+
+		stage_move_chunk(&header, keep, delta, old_lines, new_lines);
+		if (!io_printf(io, "@@ -%lu,%lu +%lu,%lu @@\n",
+			       header.old.position, header.old.lines,
+			       header.new.position, header.new.lines))
 			return FALSE;
+
+		for (line = chunk + 1; line < end; line++) {
+			const char *data = line->data;
+			char marker = stage_queue_marker(line, keep);
+
+			if (line->wrapped)
+				continue;
+
+			/* The no newline marker belongs to the line above. */
+			if (marker == '\\' ? !written : !marker) {
+				written = FALSE;
+				continue;
+			}
+
+			if (!io_printf(io, "%c%s\n", marker, data + 1))
+				return FALSE;
+			written = TRUE;
 		}
 
-	} else if (!status_update_file(&stage_status, stage_line_type)) {
-		report("Failed to update file");
-		return FALSE;
+		delta += (long) new_lines - (long) old_lines;
 	}
 
 	return TRUE;
 }
 
 static bool
-stage_revert(struct view *view, struct line *line)
+stage_apply_queue(struct view *view)
 {
-	struct line *chunk = NULL;
+	const char *apply_argv[SIZEOF_ARG] = {
+		"git", "apply", "--whitespace=nowarn", "--cached", NULL
+	};
+	struct io io;
+	bool ok;
+	int argc = 4;
 
-	if (!is_initial_commit() && stage_line_type == LINE_STAT_UNSTAGED)
-		chunk = find_prev_line_by_type(view, line, LINE_DIFF_CHUNK);
+	if (stage_line_type == LINE_STAT_STAGED)
+		apply_argv[argc++] = "-R";
+	apply_argv[argc++] = "-";
+	apply_argv[argc++] = NULL;
+	if (!io_run(&io, IO_WR, opt_cdup, opt_env, apply_argv))
+		return FALSE;
 
-	if (chunk) {
-		if (!prompt_yesno("Are you sure you want to revert changes?"))
-			return FALSE;
+	ok = stage_write_queue(view, &io);
 
-		if (!stage_apply_chunk(view, chunk, NULL, TRUE)) {
-			report("Failed to revert chunk");
-			return FALSE;
+	return io_done(&io) && ok;
+}
+
+/* Update the lines after the queue has been applied the way the diff
+ * would show them when loaded again: applied changes become context or
+ * are removed, and chunks left without changes are removed. */
+static bool
+stage_update_queued(struct view *view)
+{
+	struct stage_state *state = view->private;
+	char keep = stage_queue_keep();
+	unsigned long offset = view->pos.offset, lineno = view->pos.lineno;
+	unsigned long old_lines = 0, new_lines = 0;
+	size_t from, to = 0, chunk = view->lines;
+	struct chunk_header header;
+	enum line_type type = LINE_DEFAULT;
+	bool skip = FALSE, changes = FALSE, ok = TRUE;
+	long delta = 0;
+
+	reset_search_matches(view);
+
+	for (from = 0; from <= view->lines; from++) {
+		struct line *line = &view->line[from];
+		bool last = from == view->lines;
+		bool in_chunk = chunk < to;
+		char *data = last ? NULL : line->data;
+
+		if (!last && line->wrapped)
+			goto copy;
+
+		if (last || line->type == LINE_DIFF_CHUNK || line->type == LINE_DIFF_HEADER) {
+			if (in_chunk && !changes) {
+				for (; to > chunk; to--)
+					if (view->line[to - 1].wrapped)
+						view->custom_lines--;
+				offset = MIN(offset, to);
+				lineno = MIN(lineno, to);
+
+			} else if (in_chunk) {
+				const char *context = strstr(view->line[chunk].data + 2, "@@");
+				char buf[SIZEOF_STR];
+
+				stage_move_chunk(&header, keep == '-' ? '+' : '-', delta, old_lines, new_lines);
+				delta += (long) new_lines - (long) old_lines;
+
+				if (!string_format(buf, "@@ -%lu,%lu +%lu,%lu @@%s",
+						   header.old.position, header.old.lines,
+						   header.new.position, header.new.lines,
+						   context ? context + 2 : "") ||
+				    !(data = view_alloc(view, strlen(buf) + 1))) {
+					ok = FALSE;
+				} else {
+					strcpy(data, buf);
+					view->line[chunk].data = data;
+					while (++chunk < to && view->line[chunk].wrapped)
+						view->line[chunk].data = data;
+				}
+			}
+
+			chunk = view->lines;
+			if (last)
+				break;
+
+			if (line->type == LINE_DIFF_CHUNK && parse_chunk_header(&header, line->data)) {
+				chunk = to;
+				old_lines = new_lines = 0;
+				changes = FALSE;
+			}
+			skip = FALSE;
+			type = line->type;
+
+		} else if (!in_chunk) {
+			skip = FALSE;
+			type = line->type;
+
+		} else {
+			bool after_skip = skip;
+
+			skip = FALSE;
+			type = line->type;
+
+			if (line->user_flags & DIFF_LINE_QUEUED) {
+				line->user_flags &= ~DIFF_LINE_QUEUED;
+				if (*data == keep) {
+					skip = TRUE;
+				} else {
+					*data = ' ';
+					type = LINE_DEFAULT;
+				}
+
+			} else if (*data == '\\') {
+				/* The no newline marker belongs to the line above. */
+				skip = after_skip;
+			}
+
+			if (!skip) {
+				old_lines += *data == ' ' || *data == '-';
+				new_lines += *data == ' ' || *data == '+';
+				changes |= *data == '+' || *data == '-';
+			}
 		}
-		return TRUE;
 
-	} else {
-		return status_revert(stage_status.status ? &stage_status : NULL,
-				     stage_line_type, FALSE);
+copy:
+		if (from == view->pos.offset)
+			offset = to;
+		if (from == view->pos.lineno)
+			lineno = to;
+
+		if (skip) {
+			if (line->wrapped)
+				view->custom_lines--;
+			continue;
+		}
+
+		view->line[to] = *line;
+		view->line[to].type = type;
+		view->line[to].dirty = 1;
+		to++;
 	}
-}
 
+	view->lines = to;
+	for (from = 0, to = 0; from < view->lines; from++) {
+		if (!view->line[from].wrapped)
+			to++;
+		view->line[from].lineno = to;
+	}
+	view->renumber = FALSE;
+
+	view->pos.lineno = MIN(lineno, view->lines ? view->lines - 1 : 0);
+	view->pos.offset = MIN(offset, view->pos.lineno);
+
+	state->queued = 0;
+	diff_index_reset(&state->diff.index);
+
+	/* Wrap the changed chunk headers again. */
+	if (view->wrap_width) {
+		view->wrap_width = 0;
+		rewrap_view(view);
+	}
+
+	return ok;
+}
 
 static void
 stage_next(struct view *view, struct line *line)
 {
 	struct stage_state *state = view->private;
-	int i;
+	struct diff_index *index = &state->diff.index;
+	size_t low = 0, high;
 
-	if (!state->chunks) {
-		for (line = view->line; view_has_line(view, line); line++) {
-			if (line->type != LINE_DIFF_CHUNK)
-				continue;
+	if (!diff_index_update(view, &state->diff)) {
+		report("Allocation failure");
+		return;
+	}
 
-			if (!realloc_ints(&state->chunk, state->chunks, 1)) {
-				report("Allocation failure");
-				return;
-			}
+	/* Find the first chunk below the top of the view. */
+	high = index->chunks;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
 
-			state->chunk[state->chunks++] = line - view->line;
-		}
+		if (index->chunk[mid] <= view->pos.lineno)
+			low = mid + 1;
+		else
+			high = mid;
 	}
 
-	for (i = 0; i < state->chunks; i++) {
-		if (state->chunk[i] > view->pos.lineno) {
-			do_scroll_view(view, state->chunk[i] - view->pos.lineno);
-			report("Chunk %d of %zd", i + 1, state->chunks);
-			return;
-		}
+	if (low < index->chunks) {
+		do_scroll_view(view, index->chunk[low] - view->pos.lineno);
+		report("Chunk %zd of %zd", low + 1, index->chunks);
+		return;
 	}
 
 	report("No next chunk found");
@@ -7576,11 +9334,11 @@ stage_insert_chunk(struct view *view, struct chunk_header *header,
 			header->new.position, header->new.lines))
 		return NULL;
 
-	chunk_line = strdup(buf);
+	chunk_line = view_alloc(view, strlen(buf) + 1);
 	if (!chunk_line)
 		return NULL;
 
-	free(from->data);
+	strcpy(chunk_line, buf);
 	from->data = chunk_line;
 
 	if (!to)
@@ -7652,7 +9410,10 @@ stage_split_chunk(struct view *view, struct line *chunk_start)
 	}
 
 	if (chunks) {
+		struct stage_state *state = view->private;
+
 		stage_insert_chunk(view, &header, chunk_start, NULL, NULL);
+		diff_index_reset(&state->diff.index);
 		redraw_view(view);
 		report("Split the chunk in %d", chunks + 1);
 	} else {
@@ -7660,21 +9421,51 @@ stage_split_chunk(struct view *view, struct line *chunk_start)
 	}
 }
 
+/* Requests which load the diff again would drop the queued lines. */
+static bool
+stage_check_queue(struct view *view)
+{
+	struct stage_state *state = view->private;
+	char update_key[SIZEOF_STR];
+
+	if (!state->queued)
+		return TRUE;
+
+	/* The keys are formatted into a static buffer. */
+	string_copy(update_key, get_view_key(view, REQ_STATUS_UPDATE));
+	report("%zd lines queued, press %s to update them or %s to unqueue them",
+	       state->queued, update_key, get_view_key(view, REQ_STAGE_QUEUE));
+	return FALSE;
+}
+
 static enum request
 stage_request(struct view *view, enum request request, struct line *line)
 {
+	struct stage_state *state = view->private;
+	bool update_queued = FALSE;
+
 	switch (request) {
 	case REQ_STATUS_UPDATE:
-		if (!stage_update(view, line, FALSE))
+		if (state->queued) {
+			if (!stage_apply_queue(view)) {
+				report("Failed to apply queued changes");
+				return REQ_NONE;
+			}
+			update_queued = TRUE;
+
+		} else if (!stage_update(view, line, FALSE)) {
 			return REQ_NONE;
+		}
 		break;
 
 	case REQ_STATUS_REVERT:
-		if (!stage_revert(view, line))
+		if (!stage_check_queue(view) || !stage_revert(view, line))
 			return REQ_NONE;
 		break;
 
 	case REQ_STAGE_UPDATE_LINE:
+		if (!stage_check_queue(view))
+			return REQ_NONE;
 		if (stage_line_type == LINE_STAT_UNTRACKED ||
 		    stage_status.status == 'A') {
 			report("Staging single lines is not supported for new files");
@@ -7699,17 +9490,29 @@ stage_request(struct view *view, enum request request, struct line *line)
 
 	case REQ_STAGE_SPLIT_CHUNK:
 		if (stage_line_type == LINE_STAT_UNTRACKED ||
-		    !(line = find_prev_line_by_type(view, line, LINE_DIFF_CHUNK))) {
+		    !(line = diff_find_chunk(view, line))) {
 			report("No chunks to split in sight");
 			return REQ_NONE;
 		}
 		stage_split_chunk(view, line);
 		return REQ_NONE;
 
+	case REQ_STAGE_QUEUE:
+		if (is_initial_commit() || stage_line_type == LINE_STAT_UNTRACKED ||
+		    stage_status.status == 'A') {
+			report("Queuing changes is not supported for new files");
+			return REQ_NONE;
+		}
+		stage_queue(view, line);
+		return REQ_NONE;
+
 	case REQ_EDIT:
 		if (!stage_status.new.name[0])
 			return diff_common_edit(view, request, line);
 
+		if (!stage_check_queue(view))
+			return REQ_NONE;
+
 		if (stage_status.status == 'D') {
 			report("File has been deleted.");
 			return REQ_NONE;
@@ -7723,6 +9526,8 @@ stage_request(struct view *view, enum request request, struct line *line)
 		break;
 
 	case REQ_REFRESH:
+		if (!stage_check_queue(view))
+			return REQ_NONE;
 		/* Reload everything(including current branch information) ... */
 		load_refs(TRUE);
 		break;
@@ -7739,7 +9544,7 @@ stage_request(struct view *view, enum request request, struct line *line)
 
 	case REQ_DIFF_CONTEXT_UP:
 	case REQ_DIFF_CONTEXT_DOWN:
-		if (!update_diff_context(request))
+		if (!stage_check_queue(view) || !update_diff_context(request))
 			return REQ_NONE;
 		break;
 
@@ -7756,7 +9561,11 @@ stage_request(struct view *view, enum request request, struct line *line)
 		return REQ_VIEW_CLOSE;
 	}
 
-	refresh_view(view);
+	/* Update the lines instead of loading the diff again. */
+	if (update_queued && stage_update_queued(view))
+		redraw_view(view);
+	else
+		refresh_view(view);
 
 	return REQ_NONE;
 }
@@ -7840,15 +9649,23 @@ stage_read(struct view *view, char *data)
 		return pager_common_read(view, data, LINE_DEFAULT);
 
 	if (data && diff_common_read(view, data, &state->diff))
-		return TRUE;
+		return diff_index_update(view, &state->diff);
 
 	return pager_read(view, data);
 }
 
+static void
+stage_done(struct view *view)
+{
+	struct stage_state *state = view->private;
+
+	diff_index_free(&state->diff.index);
+}
+
 static struct view_ops stage_ops = {
 	"line",
 	{ "stage" },
-	VIEW_DIFF_LIKE,
+	VIEW_DIFF_LIKE | VIEW_WRAP_LINES,
 	sizeof(struct stage_state),
 	stage_open,
 	stage_read,
@@ -7856,6 +9673,7 @@ static struct view_ops stage_ops = {
 	stage_request,
 	pager_grep,
 	pager_select,
+	stage_done,
 };
 
 
@@ -7939,11 +9757,23 @@ struct commit {
 	const struct ident *author;	/* Author of the commit. */
 	struct time time;		/* Date from the author ident. */
 	struct graph_canvas graph;	/* Ancestry chain graphics. */
+	char *parents;			/* Parent IDs pending graph layout. */
+	bool is_boundary;		/* Is this a boundary commit? */
+	bool history_match;		/* Found by the history search. */
 	char title[1];			/* First line of the commit message. */
 };
 
+enum main_changes_check {
+	MAIN_CHANGES_NONE,
+	MAIN_CHANGES_INDEX,
+	MAIN_CHANGES_UNSTAGED,
+	MAIN_CHANGES_STAGED,
+};
+
 struct main_state {
 	struct graph graph;
+	size_t graph_lines;
+	bool has_parents;
 	struct commit current;
 	char **reflog;
 	size_t reflogs;
@@ -7952,6 +9782,18 @@ struct main_state {
 	bool in_header;
 	bool added_changes_commits;
 	bool with_graph;
+	bool read_raw;
+	struct io changes_io;		/* Check for staged or unstaged changes. */
+	enum main_changes_check changes_check;
+	char changes_parent[SIZEOF_REV];
+	bool has_staged_changes;
+	bool has_unstaged_changes;
+	time_t changes_polled;
+	FILE *cache;			/* Log lines written to the new cache. */
+	bool cache_pending;		/* Read the cache when git log is done. */
+	bool history_search;		/* Reading commits found by git log. */
+	bool history_pending;		/* Search the history once loaded. */
+	size_t history_lineno;		/* Line after the last commit found. */
 };
 
 static void
@@ -7960,8 +9802,55 @@ main_register_commit(struct view *view, struct commit *commit, const char *ids,
 	struct main_state *state = view->private;
 
 	string_copy_rev(commit->id, ids);
-	if (state->with_graph)
-		graph_add_commit(&state->graph, &commit->graph, commit->id, ids, is_boundary);
+	if (state->with_graph) {
+		const char *parents = strchr(ids, ' ');
+
+		/* Defer the layout until the commit is drawn. */
+		commit->parents = strdup(parents ? parents : "");
+		commit->is_boundary = is_boundary;
+		if (parents)
+			state->has_parents = TRUE;
+	}
+}
+
+static bool
+main_add_parent(struct commit *commit, const char *parent)
+{
+	size_t size = commit->parents ? strlen(commit->parents) : 0;
+	char *parents = realloc(commit->parents, size + strlen(parent) + 2);
+
+	if (!parents)
+		return FALSE;
+
+	parents[size] = ' ';
+	strcpy(parents + size + 1, parent);
+	commit->parents = parents;
+	return TRUE;
+}
+
+/* Lay out the graph up to and including the given line. The column
+ * state only depends on the commits above, so the graph is built on
+ * demand from the parents recorded while reading. */
+static void
+main_layout_graph(struct view *view, struct line *line)
+{
+	struct main_state *state = view->private;
+	size_t lineno = line - view->line;
+
+	/* Wait until the changes commits have been added at the top. */
+	if (state->changes_check)
+		return;
+
+	for (; state->graph_lines <= lineno; state->graph_lines++) {
+		struct commit *commit = view->line[state->graph_lines].data;
+		const char *parents = commit->parents ? commit->parents : "";
+
+		if (graph_add_commit(&state->graph, &commit->graph, commit->id,
+				     parents, commit->is_boundary))
+			graph_render_parents(&state->graph);
+		free(commit->parents);
+		commit->parents = NULL;
+	}
 }
 
 static struct commit *
@@ -7973,92 +9862,297 @@ main_add_commit(struct view *view, enum line_type type, struct commit *template,
 	struct commit *commit;
 	char buf[SIZEOF_STR / 2];
 
-	/* FIXME: More graceful handling of titles; append "..." to
-	 * shortened titles, etc. */
-	string_expand(buf, sizeof(buf), title, 1);
-	title = buf;
-	titlelen = strlen(title);
+	/* FIXME: More graceful handling of titles; append "..." to
+	 * shortened titles, etc. */
+	string_expand(buf, sizeof(buf), title, 1);
+	title = buf;
+	titlelen = strlen(title);
+
+	if (!add_line_alloc(view, &commit, type, titlelen, custom))
+		return NULL;
+
+	*commit = *template;
+	strncpy(commit->title, title, titlelen);
+	memset(template, 0, sizeof(*template));
+	state->reflogmsg[0] = 0;
+	return commit;
+}
+
+static inline void
+main_flush_commit(struct view *view, struct commit *commit)
+{
+	if (*commit->id)
+		main_add_commit(view, LINE_MAIN_COMMIT, commit, "", FALSE);
+}
+
+/*
+ * Staged and unstaged changes are checked while the history is read. The
+ * checks run one after another in the background and the commits for the
+ * changes are inserted at the top of the view once all have finished.
+ */
+
+static bool
+main_start_changes_check(struct main_state *state, enum main_changes_check check)
+{
+	static const char *staged_argv[] = { GIT_DIFF_STAGED_FILES("--quiet") };
+	static const char *unstaged_argv[] = { GIT_DIFF_UNSTAGED_FILES("--quiet") };
+	const char **argv = check == MAIN_CHANGES_INDEX ? update_index_argv
+			  : check == MAIN_CHANGES_UNSTAGED ? unstaged_argv
+			  : staged_argv;
+
+	state->changes_check = MAIN_CHANGES_NONE;
+	if (!io_run(&state->changes_io, IO_RD, NULL, opt_env, argv))
+		return FALSE;
+	state->changes_check = check;
+	return TRUE;
+}
+
+static bool
+main_add_changes_commit(struct view *view, unsigned long pos, enum line_type type,
+			const char *parent, const char *title)
+{
+	char ids[SIZEOF_STR] = NULL_ID " ";
+	struct commit commit = {};
+	struct commit *data;
+	struct line *line;
+	struct timeval now;
+	struct timezone tz;
+
+	if (!parent)
+		return FALSE;
+
+	string_copy_rev(ids + STRING_SIZE(NULL_ID " "), parent);
+
+	if (!gettimeofday(&now, &tz)) {
+		commit.time.tz = tz.tz_minuteswest * 60;
+		commit.time.sec = now.tv_sec - commit.time.tz;
+	}
+
+	commit.author = &unknown_ident;
+	main_register_commit(view, &commit, ids, FALSE);
+
+	line = add_line_at(view, pos, NULL, type, sizeof(commit) + strlen(title), TRUE);
+	if (!line) {
+		free(commit.parents);
+		return FALSE;
+	}
+
+	data = line->data;
+	*data = commit;
+	strncpy(data->title, title, strlen(title));
+	return TRUE;
+}
+
+static void
+main_add_changes_commits(struct view *view, struct main_state *state)
+{
+	const char *parent = state->changes_parent;
+	const char *staged_parent = NULL_ID;
+	const char *unstaged_parent = parent;
+	unsigned long added = 0;
+
+	if (!state->has_unstaged_changes) {
+		unstaged_parent = NULL;
+		staged_parent = parent;
+	}
+
+	if (!state->has_staged_changes) {
+		staged_parent = NULL;
+	}
+
+	if (main_add_changes_commit(view, added, LINE_STAT_STAGED, staged_parent, "Staged changes"))
+		added++;
+	if (main_add_changes_commit(view, added, LINE_STAT_UNSTAGED, unstaged_parent, "Unstaged changes"))
+		added++;
+
+	/* Keep the cursor on the same commit unless it is still at the top. */
+	if (added && view->pos.lineno) {
+		view->pos.lineno += added;
+		view->pos.offset += added;
+	}
+	view->force_redraw = TRUE;
+}
+
+/* Advance to the next check once the current has finished. When all
+ * checks are done the changes are added to the view. */
+static void
+main_update_changes(struct view *view, struct main_state *state)
+{
+	char buf[BUFSIZ];
+
+	while (state->changes_check && io_can_read(&state->changes_io, FALSE)) {
+		enum main_changes_check check = state->changes_check;
+		bool has_changes;
+
+		if (io_read(&state->changes_io, buf, sizeof(buf)) > 0)
+			continue;
+
+		/* The exit code of git diff --quiet tells whether there
+		 * are changes. */
+		io_done(&state->changes_io);
+		has_changes = state->changes_io.status == 1;
+		state->changes_check = MAIN_CHANGES_NONE;
+
+		if (check == MAIN_CHANGES_UNSTAGED)
+			state->has_unstaged_changes = has_changes;
+		else if (check == MAIN_CHANGES_STAGED)
+			state->has_staged_changes = has_changes;
+
+		if (check == MAIN_CHANGES_STAGED ||
+		    !main_start_changes_check(state, check + 1))
+			main_add_changes_commits(view, state);
+	}
+}
+
+static void
+main_check_changes(struct view *view, struct main_state *state, const char *parent)
+{
+	if (!is_head_commit(parent))
+		return;
+
+	state->added_changes_commits = TRUE;
+	string_copy_rev(state->changes_parent, parent);
+	main_start_changes_check(state, MAIN_CHANGES_INDEX);
+}
 
-	if (!add_line_alloc(view, &commit, type, titlelen, custom))
-		return NULL;
+static void
+main_abort_changes(struct main_state *state)
+{
+	if (!state->changes_check)
+		return;
 
-	*commit = *template;
-	strncpy(commit->title, title, titlelen);
-	state->graph.canvas = &commit->graph;
-	memset(template, 0, sizeof(*template));
-	state->reflogmsg[0] = 0;
-	return commit;
+	io_kill(&state->changes_io);
+	io_done(&state->changes_io);
+	state->changes_check = MAIN_CHANGES_NONE;
 }
 
-static inline void
-main_flush_commit(struct view *view, struct commit *commit)
+/*
+ * The main view cache stores the log lines of the last load of the main
+ * view in the git directory. The first line records the HEAD commit and
+ * the git log command used so the cache can be replayed when neither has
+ * changed, or extended with only the new commits when HEAD has moved
+ * forward.
+ */
+
+#define MAIN_CACHE_FILE		"tig-main-cache"
+#define MAIN_CACHE_HEADER	"tig-main-cache-1 "
+
+static bool
+main_cache_path(char *path, const char *suffix)
 {
-	if (*commit->id)
-		main_add_commit(view, LINE_MAIN_COMMIT, commit, "", FALSE);
+	return string_format_size(path, SIZEOF_STR, "%s/%s%s",
+				  opt_git_dir, MAIN_CACHE_FILE, suffix);
 }
 
+/* Restart the history walk so it stops at the cached HEAD commit. */
 static bool
-main_has_changes(const char *argv[])
+main_cache_exclude(struct view *view, const char *id)
 {
+	const char **argv = NULL;
+	char exclude[SIZEOF_REV + 1];
 	struct io io;
+	bool ok = string_format(exclude, "^%s", id);
+	int i;
 
-	if (!io_run(&io, IO_BG, NULL, opt_env, argv, -1))
+	for (i = 0; ok && view->argv[i]; i++) {
+		/* Without a positive revision git log would show nothing. */
+		if (!strcmp(view->argv[i], "--"))
+			ok = argv_append(&argv, "HEAD") && argv_append(&argv, exclude);
+		ok = ok && argv_append(&argv, view->argv[i]);
+	}
+
+	ok = ok && io_run(&io, IO_RD, view->dir, opt_env, argv);
+	argv_free(argv);
+	free(argv);
+	if (!ok)
 		return FALSE;
-	io_done(&io);
-	return io.status == 1;
+
+	io_kill(view->pipe);
+	io_done(view->pipe);
+	*view->pipe = io;
+	return TRUE;
 }
 
 static void
-main_add_changes_commit(struct view *view, enum line_type type, const char *parent, const char *title)
+main_cache_open(struct view *view, struct main_state *state)
 {
-	char ids[SIZEOF_STR] = NULL_ID " ";
-	struct main_state *state = view->private;
-	struct commit commit = {};
-	struct timeval now;
-	struct timezone tz;
+	struct ref *head = get_ref_head();
+	char path[SIZEOF_STR];
+	char header[SIZEOF_STR];
+	char cmd[SIZEOF_STR];
+	char old_id[SIZEOF_REV];
+	struct io io;
+	char *line;
 
-	if (!parent)
+	/* Only the plain history of HEAD can be cached, and only when the
+	 * log lines are used as is. */
+	if (!head || opt_rev_argv || opt_diff_argv || opt_file_argv || default_encoding ||
+	    !main_cache_path(path, "") ||
+	    !argv_to_string(view->argv, cmd, sizeof(cmd), " ") ||
+	    !string_format(header, "%s%s %s", MAIN_CACHE_HEADER, head->id, cmd))
 		return;
 
-	string_copy_rev(ids + STRING_SIZE(NULL_ID " "), parent);
+	if (io_open(&io, "%s", path) &&
+	    (line = io_get(&io, '\n', TRUE)) &&
+	    !prefixcmp(line, MAIN_CACHE_HEADER) &&
+	    strlen(line) >= STRING_SIZE(MAIN_CACHE_HEADER) + SIZEOF_REV &&
+	    !strcmp(line + STRING_SIZE(MAIN_CACHE_HEADER) + SIZEOF_REV, cmd)) {
+		if (!strcmp(line, header)) {
+			/* Nothing has changed, so replay the cache. */
+			io_kill(view->pipe);
+			io_done(view->pipe);
+			*view->pipe = io;
+			return;
+		}
 
-	if (!gettimeofday(&now, &tz)) {
-		commit.time.tz = tz.tz_minuteswest * 60;
-		commit.time.sec = now.tv_sec - commit.time.tz;
+		string_copy_rev(old_id, line + STRING_SIZE(MAIN_CACHE_HEADER));
+		if (opt_commit_order != COMMIT_ORDER_REVERSE) {
+			const char *ancestor_argv[] = {
+				"git", "merge-base", "--is-ancestor", old_id, head->id, NULL
+			};
+
+			state->cache_pending = io_run_bg(ancestor_argv) &&
+					       main_cache_exclude(view, old_id);
+		}
 	}
+	io_done(&io);
 
-	commit.author = &unknown_ident;
-	main_register_commit(view, &commit, ids, FALSE);
-	if (main_add_commit(view, type, &commit, title, TRUE) && state->with_graph)
-		graph_render_parents(&state->graph);
+	if (main_cache_path(path, ".tmp") && (state->cache = fopen(path, "w")))
+		fprintf(state->cache, "%s\n", header);
 }
 
-static void
-main_add_changes_commits(struct view *view, struct main_state *state, const char *parent)
+/* Continue with the cached commits once the new commits have been read. */
+static bool
+main_cache_continue(struct view *view, struct main_state *state)
 {
-	const char *staged_argv[] = { GIT_DIFF_STAGED_FILES("--quiet") };
-	const char *unstaged_argv[] = { GIT_DIFF_UNSTAGED_FILES("--quiet") };
-	const char *staged_parent = NULL_ID;
-	const char *unstaged_parent = parent;
+	char path[SIZEOF_STR];
 
-	if (!is_head_commit(parent))
-		return;
+	if (!state->cache_pending || !io_eof(view->pipe))
+		return FALSE;
 
-	state->added_changes_commits = TRUE;
+	state->cache_pending = FALSE;
+	io_done(view->pipe);
+	return main_cache_path(path, "") && io_open(view->pipe, "%s", path);
+}
 
-	io_run_bg(update_index_argv);
+static void
+main_cache_done(struct view *view, struct main_state *state)
+{
+	bool complete = io_eof(view->pipe) && !io_error(view->pipe);
+	char path[SIZEOF_STR];
+	char tmp[SIZEOF_STR];
 
-	if (!main_has_changes(unstaged_argv)) {
-		unstaged_parent = NULL;
-		staged_parent = parent;
-	}
+	if (!state->cache)
+		return;
 
-	if (!main_has_changes(staged_argv)) {
-		staged_parent = NULL;
-	}
+	if (fclose(state->cache))
+		complete = FALSE;
+	state->cache = NULL;
 
-	main_add_changes_commit(view, LINE_STAT_STAGED, staged_parent, "Staged changes");
-	main_add_changes_commit(view, LINE_STAT_UNSTAGED, unstaged_parent, "Unstaged changes");
+	if (!main_cache_path(path, "") || !main_cache_path(tmp, ".tmp"))
+		return;
+	if (!complete || rename(tmp, path))
+		unlink(tmp);
 }
 
 static bool
@@ -8070,13 +10164,29 @@ main_open(struct view *view, enum open_flags flags)
 	struct main_state *state = view->private;
 
 	state->with_graph = opt_rev_graph;
+	/* Only git log output read from stdin uses --pretty=raw. */
+	state->read_raw = open_from_stdin(flags);
 
 	if (flags & OPEN_PAGER_MODE) {
 		state->added_changes_commits = TRUE;
 		state->with_graph = FALSE;
 	}
 
-	return begin_update(view, NULL, main_argv, flags);
+	if (!begin_update(view, NULL, main_argv, flags))
+		return FALSE;
+
+	/* Set after begin_update() has reset the previous graph state. */
+	state->graph.max_width = opt_rev_graph_width;
+
+	if (opt_main_view_cache && view->pipe && !view->lines &&
+	    !(flags & (OPEN_REFRESH | OPEN_PREPARED | OPEN_STDIN | OPEN_PAGER_MODE)))
+		main_cache_open(view, state);
+
+	/* Make sure the previous position can be restored. */
+	view->max_lines = 0;
+	if (opt_main_view_page_size)
+		view->max_lines = view->prev_pos.lineno + view->height + opt_main_view_page_size;
+	return TRUE;
 }
 
 static void
@@ -8089,11 +10199,20 @@ main_done(struct view *view)
 		struct commit *commit = view->line[i].data;
 
 		free(commit->graph.symbols);
+		free(commit->parents);
+		commit->graph.symbols = NULL;
+		commit->parents = NULL;
 	}
 
+	free(state->current.parents);
+	state->current.parents = NULL;
+	done_graph(&state->graph);
+
 	for (i = 0; i < state->reflogs; i++)
 		free(state->reflog[i]);
 	free(state->reflog);
+	state->reflog = NULL;
+	state->reflogs = 0;
 }
 
 #define MAIN_NO_COMMIT_REFS 1
@@ -8141,8 +10260,11 @@ main_draw(struct view *view, struct line *line, unsigned int lineno)
 	if (draw_author(view, commit->author))
 		return TRUE;
 
-	if (state->with_graph && draw_graph(view, &commit->graph))
-		return TRUE;
+	if (state->with_graph) {
+		main_layout_graph(view, line);
+		if (draw_graph(view, &commit->graph))
+			return TRUE;
+	}
 
 	if ((refs = main_get_commit_refs(line, commit)) && draw_refs(view, refs))
 		return TRUE;
@@ -8158,9 +10280,8 @@ main_add_reflog(struct view *view, struct main_state *state, char *reflog)
 	char *end = strchr(reflog, ' ');
 	int id_width;
 
-	if (!end)
-		return FALSE;
-	*end = 0;
+	if (end)
+		*end = 0;
 
 	if (!realloc_reflogs(&state->reflog, state->reflogs, 1)
 	    || !(reflog = strdup(reflog)))
@@ -8177,34 +10298,90 @@ main_add_reflog(struct view *view, struct main_state *state, char *reflog)
 	return TRUE;
 }
 
-/* Reads git log --pretty=raw output and parses it into the commit struct. */
-static bool
-main_read(struct view *view, char *line)
+static void
+main_read_done(struct view *view)
 {
 	struct main_state *state = view->private;
-	struct graph *graph = &state->graph;
-	enum line_type type;
-	struct commit *commit = &state->current;
 
-	if (!line) {
-		main_flush_commit(view, commit);
+	main_flush_commit(view, &state->current);
 
-		if (!view->lines && !view->prev)
-			die("No revisions match the given arguments.");
-		if (view->lines > 0) {
-			struct commit *last = view->line[view->lines - 1].data;
+	if (!view->lines && !view->prev)
+		die("No revisions match the given arguments.");
+	if (view->lines > 0) {
+		struct commit *last = view->line[view->lines - 1].data;
 
-			view->line[view->lines - 1].dirty = 1;
-			if (!last->author) {
-				view->lines--;
-				free(last);
-			}
+		view->line[view->lines - 1].dirty = 1;
+		if (!last->author) {
+			view->lines--;
+			free(last->parents);
 		}
+	}
+}
 
-		if (state->with_graph)
-			done_graph(graph);
-		return TRUE;
+enum main_log_field {
+	MAIN_LOG_IDS,
+	MAIN_LOG_AUTHOR,
+	MAIN_LOG_TIME,
+	MAIN_LOG_DATE,
+	MAIN_LOG_REFLOG,
+	MAIN_LOG_REFLOGMSG,
+	MAIN_LOG_TITLE,
+	MAIN_LOG_FIELDS,
+};
+
+/* Reads a commit line formatted using GIT_MAIN_LOG_FORMAT. */
+static bool
+main_read_format(struct view *view, char *line)
+{
+	struct main_state *state = view->private;
+	struct commit *commit = &state->current;
+	char *field[MAIN_LOG_FIELDS];
+	char *ids, *zone;
+	bool is_boundary;
+	int i;
+
+	/* The title is last so it is never split. */
+	for (i = 0; i < MAIN_LOG_TITLE; i++) {
+		char *sep = strchr(line, '\x1f');
+
+		if (!sep)
+			return TRUE;
+		*sep = 0;
+		field[i] = line;
+		line = sep + 1;
 	}
+	field[MAIN_LOG_TITLE] = line;
+
+	ids = field[MAIN_LOG_IDS];
+	is_boundary = *ids == '-';
+	while (*ids && !isalnum(*ids))
+		ids++;
+
+	if (!state->added_changes_commits && opt_show_changes && opt_is_inside_work_tree)
+		main_check_changes(view, state, ids);
+
+	main_register_commit(view, commit, ids, is_boundary);
+	parse_author_line(field[MAIN_LOG_AUTHOR], &commit->author, NULL);
+	parse_timesec(&commit->time, field[MAIN_LOG_TIME]);
+	zone = strrchr(field[MAIN_LOG_DATE], ' ');
+	if (zone && strlen(zone) == STRING_SIZE(" +0700"))
+		parse_timezone(&commit->time, zone + 1);
+
+	if (*field[MAIN_LOG_REFLOG] &&
+	    !main_add_reflog(view, state, field[MAIN_LOG_REFLOG]))
+		return FALSE;
+
+	line = *field[MAIN_LOG_REFLOGMSG] ? field[MAIN_LOG_REFLOGMSG] : field[MAIN_LOG_TITLE];
+	return !!main_add_commit(view, LINE_MAIN_COMMIT, commit, line, FALSE);
+}
+
+/* Reads git log --pretty=raw output and parses it into the commit struct. */
+static bool
+main_read_raw(struct view *view, char *line)
+{
+	struct main_state *state = view->private;
+	enum line_type type;
+	struct commit *commit = &state->current;
 
 	type = get_line_type(line);
 	if (type == LINE_COMMIT) {
@@ -8217,7 +10394,7 @@ main_read(struct view *view, char *line)
 			line++;
 
 		if (!state->added_changes_commits && opt_show_changes && opt_is_inside_work_tree)
-			main_add_changes_commits(view, state, line);
+			main_check_changes(view, state, line);
 		else
 			main_flush_commit(view, commit);
 
@@ -8244,15 +10421,14 @@ main_read(struct view *view, char *line)
 		break;
 
 	case LINE_PARENT:
-		if (state->with_graph && !graph->has_parents)
-			graph_add_parent(graph, line + STRING_SIZE("parent "));
+		if (state->with_graph && !state->has_parents &&
+		    !main_add_parent(commit, line + STRING_SIZE("parent ")))
+			return FALSE;
 		break;
 
 	case LINE_AUTHOR:
 		parse_author_line(line + STRING_SIZE("author "),
 				  &commit->author, &commit->time);
-		if (state->with_graph)
-			graph_render_parents(graph);
 		break;
 
 	default:
@@ -8283,6 +10459,170 @@ main_read(struct view *view, char *line)
 	return TRUE;
 }
 
+/*
+ * History search: commits found by git log using the search as a pickaxe
+ * or --grep option are read in the background and marked as matching in
+ * the loaded main view.
+ */
+
+static bool
+main_start_history_search(struct view *view, struct main_state *state)
+{
+	const char **argv = NULL;
+	bool ok = TRUE;
+	int i;
+
+	state->history_pending = FALSE;
+	for (i = 0; ok && view->argv && view->argv[i]; i++) {
+		const char *arg = view->argv[i];
+
+		if (!strcmp(arg, "--")) {
+			ok = argv_append(&argv, opt_search) &&
+			     (!opt_ignore_case || argv_append(&argv, "--regexp-ignore-case"));
+		} else if (!strcmp(arg, GIT_MAIN_LOG_FORMAT)) {
+			arg = "--pretty=tformat:%H";
+		}
+		ok = ok && argv_append(&argv, arg);
+	}
+
+	if (!argv || !ok || !io_run(&view->io, IO_RD, view->dir, opt_env, argv)) {
+		argv_free(argv);
+		free(argv);
+		report("Failed to search the history");
+		return FALSE;
+	}
+
+	argv_free(argv);
+	free(argv);
+
+	state->history_search = TRUE;
+	state->history_lineno = 0;
+	view->pipe = &view->io;
+	view->start_time = time(NULL);
+	report("Searching the history for '%s'", view->grep);
+	return TRUE;
+}
+
+/* The history search reads the commit IDs found by git log through the
+ * view pipe, so a view which is still being loaded is first read to the
+ * end and the search is started from main_read() when it is done. */
+static void
+main_search_history(struct view *view, struct main_state *state)
+{
+	int i;
+
+	if (state->history_search)
+		end_update(view, TRUE);
+
+	reset_search_matches(view);
+	string_ncopy(view->grep, opt_search, strlen(opt_search));
+	view->grep_literal_len = 0;
+	view->grep_is_literal = FALSE;
+	for (i = 0; i < view->lines; i++) {
+		struct commit *commit = view->line[i].data;
+
+		commit->history_match = FALSE;
+	}
+
+	if (!view->pipe) {
+		main_start_history_search(view, state);
+		return;
+	}
+
+	state->history_pending = TRUE;
+	view->max_lines = 0;
+	report("Searching the history for '%s' once the view is loaded", view->grep);
+}
+
+static bool
+main_read_history(struct view *view, struct main_state *state, char *id)
+{
+	size_t lineno, i;
+
+	if (!id) {
+		/* The matches found so far are all there will be. */
+		state->history_search = FALSE;
+		view->matches_checked = view->lines;
+		report("Found %zd commit%s matching '%s'", view->matches_size,
+		       view->matches_size == 1 ? "" : "s", view->grep);
+		return TRUE;
+	}
+
+	/* Commits are usually found in the order of the view. */
+	for (i = 0; i < view->lines; i++) {
+		struct commit *commit;
+
+		lineno = (state->history_lineno + i) % view->lines;
+		commit = view->line[lineno].data;
+		if (!strncmp(commit->id, id, SIZEOF_REV - 1))
+			break;
+	}
+
+	if (i == view->lines)
+		return TRUE;
+
+	state->history_lineno = lineno + 1;
+	if (!realloc_matches(&view->matches, view->matches_size, 1))
+		return FALSE;
+
+	i = find_search_match(view, lineno);
+	memmove(view->matches + i + 1, view->matches + i,
+		(view->matches_size - i) * sizeof(*view->matches));
+	view->matches[i] = lineno;
+	view->matches_size++;
+
+	((struct commit *) view->line[lineno].data)->history_match = TRUE;
+	view->line[lineno].search_result = view->line[lineno].dirty = 1;
+	return TRUE;
+}
+
+static bool
+main_read(struct view *view, char *line)
+{
+	struct main_state *state = view->private;
+
+	if (state->history_search)
+		return main_read_history(view, state, line);
+
+	if (!line) {
+		if (main_cache_continue(view, state))
+			return FALSE;
+		if (!io_eof(view->pipe) || view->stopping)
+			main_abort_changes(state);
+		main_update_changes(view, state);
+		if (state->changes_check)
+			return FALSE;
+		main_cache_done(view, state);
+		main_read_done(view);
+		if (state->history_pending && !view->stopping) {
+			io_done(view->pipe);
+			return !main_start_history_search(view, state);
+		}
+		return TRUE;
+	}
+
+	if (state->changes_check) {
+		time_t now = time(NULL);
+
+		if (state->changes_polled != now) {
+			state->changes_polled = now;
+			main_update_changes(view, state);
+		}
+
+		/* Do not pause reading before the changes are known. */
+		if (view->max_lines && view->lines + 1 >= view->max_lines)
+			view->max_lines += opt_main_view_page_size;
+	}
+
+	if (state->read_raw)
+		return main_read_raw(view, line);
+	if (!prefixcmp(line, MAIN_CACHE_HEADER))
+		return TRUE;
+	if (state->cache)
+		fprintf(state->cache, "%s\n", line);
+	return main_read_format(view, line);
+}
+
 static enum request
 main_request(struct view *view, enum request request, struct line *line)
 {
@@ -8331,6 +10671,13 @@ main_request(struct view *view, enum request request, struct line *line)
 		refresh_view(view);
 		break;
 
+	case REQ_SEARCH:
+	case REQ_SEARCH_BACK:
+		if (!is_history_search(view, opt_search))
+			return request;
+		main_search_history(view, view->private);
+		break;
+
 	case REQ_JUMP_COMMIT:
 	{
 		int lineno;
@@ -8356,17 +10703,16 @@ main_request(struct view *view, enum request request, struct line *line)
 }
 
 static bool
-grep_refs(struct line *line, struct commit *commit, regex_t *regex)
+grep_refs(struct view *view, struct line *line, struct commit *commit)
 {
 	struct ref_list *list;
-	regmatch_t pmatch;
 	size_t i;
 
 	if (!opt_show_refs || !(list = main_get_commit_refs(line, commit)))
 		return FALSE;
 
 	for (i = 0; i < list->size; i++) {
-		if (!regexec(regex, list->refs[i]->name, 1, &pmatch, 0))
+		if (grep_string(view, list->refs[i]->name))
 			return TRUE;
 	}
 
@@ -8385,13 +10731,20 @@ main_grep(struct view *view, struct line *line)
 		NULL
 	};
 
-	return grep_text(view, text) || grep_refs(line, commit, view->regex);
+	if (is_history_search(view, view->grep))
+		return commit->history_match;
+	return grep_text(view, text) || grep_refs(view, line, commit);
 }
 
 static void
 main_select(struct view *view, struct line *line)
 {
 	struct commit *commit = line->data;
+	size_t lineno = line - view->line;
+
+	/* Load the next page when getting within a screen of the end. */
+	if (view->max_lines && lineno + view->height >= view->max_lines)
+		view->max_lines = lineno + view->height + opt_main_view_page_size;
 
 	if (line->type == LINE_STAT_STAGED || line->type == LINE_STAT_UNSTAGED)
 		string_ncopy(view->ref, commit->title, strlen(commit->title));
@@ -8418,7 +10771,7 @@ static bool
 stash_open(struct view *view, enum open_flags flags)
 {
 	static const char *stash_argv[] = { "git", "stash", "list",
-		encoding_arg, "--no-color", "--pretty=raw", NULL };
+		encoding_arg, "--no-color", GIT_MAIN_LOG_FORMAT, NULL };
 	struct main_state *state = view->private;
 
 	state->added_changes_commits = TRUE;
@@ -8601,11 +10954,13 @@ get_input(int prompt_position)
 
 		foreach_view (view, i) {
 			update_view(view);
+			if (update_search_matches(view))
+				loading = TRUE;
 			if (view_is_displayed(view) && view->has_scrolled &&
 			    use_scroll_redrawwin)
 				redrawwin(view->win);
 			view->has_scrolled = FALSE;
-			if (view->pipe)
+			if (view_is_loading(view))
 				loading = TRUE;
 		}
 
@@ -8674,10 +11029,13 @@ prompt_input(const char *prompt, input_handler handler, void *data)
 			break;
 
 		case KEY_BACKSPACE:
-			if (pos > 0)
+			if (pos > 0) {
 				buf[--pos] = 0;
-			else
+				/* Let the handler see the shortened input. */
+				handler(data, buf, key);
+			} else {
 				status = INPUT_CANCEL;
+			}
 			break;
 
 		case KEY_ESC:
@@ -8685,14 +11043,16 @@ prompt_input(const char *prompt, input_handler handler, void *data)
 			break;
 
 		default:
-			if (pos >= sizeof(buf)) {
+			if (pos >= sizeof(buf) - 1) {
 				report("Input string too long");
 				return NULL;
 			}
 
 			status = handler(data, buf, key);
-			if (status == INPUT_OK)
+			if (status == INPUT_OK) {
 				buf[pos++] = (char) key;
+				buf[pos] = 0;
+			}
 		}
 	}
 
@@ -8703,8 +11063,6 @@ prompt_input(const char *prompt, input_handler handler, void *data)
 	if (status == INPUT_CANCEL)
 		return NULL;
 
-	buf[pos++] = 0;
-
 	return buf;
 }
 
@@ -8741,6 +11099,97 @@ read_prompt(const char *prompt)
 	return prompt_input(prompt, read_prompt_handler, NULL);
 }
 
+struct search_prompt {
+	struct view *view;
+	struct position pos;	/* Position when the search started. */
+	char grep[SIZEOF_STR];	/* Search of the view before the prompt. */
+	int direction;
+	bool found;		/* Whether the current input has a match. */
+	unsigned long lineno;	/* Line matching the current input. */
+};
+
+static void
+restore_search_position(struct search_prompt *search)
+{
+	struct view *view = search->view;
+
+	if (view->pos.lineno != search->pos.lineno ||
+	    view->pos.offset != search->pos.offset) {
+		view->pos = search->pos;
+		redraw_view(view);
+		update_view_title(view);
+	}
+}
+
+/* Search the view while the search string is typed. A longer plain text
+ * search cannot match before the line matching the previous input, so
+ * the search continues from there. Typing interrupts a search which is
+ * still running. */
+static enum input_status
+search_prompt_handler(void *data, char *buf, int c)
+{
+	struct search_prompt *search = data;
+	struct view *view = search->view;
+	char grep[SIZEOF_STR];
+	unsigned long lineno = search->pos.lineno;
+	bool extends = search->found && view->grep_is_literal && !strcmp(view->grep, buf);
+	bool interrupted;
+
+	if (c == KEY_BACKSPACE) {
+		string_ncopy(grep, buf, strlen(buf));
+	} else if (isprint(c)) {
+		if (!string_format(grep, "%s%c", buf, c))
+			return INPUT_SKIP;
+		if (extends)
+			lineno = search->lineno;
+	} else {
+		return INPUT_SKIP;
+	}
+
+	/* History searches are only run when the search is entered. */
+	if (is_history_search_prefix(view, grep))
+		return INPUT_OK;
+
+	search->found = FALSE;
+	if (!*grep || !compile_search(view, grep)) {
+		if (!*grep)
+			restore_search_position(search);
+		return INPUT_OK;
+	}
+
+	search->found = find_next_line(view, &lineno, search->direction, &interrupted);
+	if (search->found) {
+		search->lineno = lineno;
+		select_view_line(view, lineno);
+	} else if (!interrupted) {
+		restore_search_position(search);
+	}
+
+	update_view_title(view);
+	return INPUT_OK;
+}
+
+static char *
+read_search_prompt(struct view *view, enum request request)
+{
+	struct search_prompt search = { view, view->pos };
+	char *input;
+
+	string_copy(search.grep, view->grep);
+	search.direction = request == REQ_SEARCH ? 1 : -1;
+
+	input = prompt_input(request == REQ_SEARCH ? "/" : "?", search_prompt_handler, &search);
+	if (!input) {
+		restore_search_position(&search);
+		if (!*search.grep || !compile_search(view, search.grep)) {
+			reset_search_matches(view);
+			*view->grep = 0;
+		}
+	}
+
+	return input;
+}
+
 static bool prompt_menu(const char *prompt, const struct menu_item *items, int *selected)
 {
 	enum input_status status = INPUT_OK;
@@ -9313,11 +11762,18 @@ run_prompt_command(struct view *view, char *cmd) {
 
 		char *args = strchr(cmd, ' ');
 		if (args) {
+			bool wrap_lines = opt_wrap_lines;
+
 			*args++ = 0;
 			if (set_option(cmd, args) == SUCCESS) {
 				request = !view->unrefreshable ? REQ_REFRESH : REQ_SCREEN_REDRAW;
 				if (!strcmp(cmd, "color"))
 					init_colors();
+				/* Wrap the lines already read instead of reloading. */
+				if (wrap_lines != opt_wrap_lines) {
+					resize_display();
+					request = REQ_SCREEN_REDRAW;
+				}
 			}
 		}
 		return request;
@@ -9472,8 +11928,7 @@ main(int argc, const char *argv[])
 		case REQ_SEARCH:
 		case REQ_SEARCH_BACK:
 		{
-			const char *prompt = request == REQ_SEARCH ? "/" : "?";
-			char *search = read_prompt(prompt);
+			char *search = read_search_prompt(view, request);
 
 			if (search)
 				string_ncopy(opt_search, search, strlen(search));
@@ -16,12 +16,19 @@
 #include "../io.h"
 #include "../graph.h"
 
+#include <sys/resource.h>
+
 #define USAGE \
-"test-graph [--ascii]\n" \
+"test-graph [--ascii] [--max-width=N]\n" \
+"test-graph [--ascii] [--max-width=N] --generate=TYPE [--count=N] [--width=N] [--bench]\n" \
+"\n" \
+"Generators: linear, octopus, parallel, criss-cross\n" \
 "\n" \
 "Example usage:\n" \
 "	# git log --pretty=raw --parents | ./test-graph\n" \
-"	# git log --pretty=raw --parents | ./test-graph --ascii"
+"	# git log --pretty=raw --parents | ./test-graph --ascii\n" \
+"	# ./test-graph --ascii --generate=octopus --count=20\n" \
+"	# ./test-graph --generate=parallel --width=1000 --count=100000 --bench"
 
 struct commit {
 	char id[SIZEOF_REV];
@@ -30,20 +37,30 @@ struct commit {
 
 DEFINE_ALLOCATOR(realloc_commits, struct commit *, 8)
 
-int
-main(int argc, const char *argv[])
+typedef const char *(*graph_symbol_fn)(struct graph_symbol *);
+
+static void
+print_canvas(struct graph_canvas *canvas, graph_symbol_fn graph_fn)
+{
+	int i;
+
+	for (i = 0; i < canvas->size; i++) {
+		struct graph_symbol *symbol = &canvas->symbols[i];
+		const char *chars = graph_fn(symbol);
+
+		printf("%s", chars + (i == 0));
+	}
+}
+
+static int
+read_commits(struct graph *graph, graph_symbol_fn graph_fn)
 {
-	struct graph graph = { };
 	struct io io = { };
 	char *line;
 	struct commit **commits = NULL;
 	size_t ncommits = 0;
 	struct commit *commit = NULL;
 	bool is_boundary;
-	const char *(*graph_fn)(struct graph_symbol *) = graph_symbol_to_utf8;
-
-	if (argc > 1 && !strcmp(argv[1], "--ascii"))
-		graph_fn = graph_symbol_to_ascii;
 
 	if (isatty(STDIN_FILENO)) {
 		die(USAGE);
@@ -71,21 +88,14 @@ main(int argc, const char *argv[])
 					die("Commit");
 				commits[ncommits++] = commit;
 				string_copy_rev(commit->id, line);
-				graph_add_commit(&graph, &commit->canvas, commit->id, line, is_boundary);
-				graph_render_parents(&graph);
+				graph_add_commit(graph, &commit->canvas, commit->id, line, is_boundary);
+				graph_render_parents(graph);
 
 			} else if (!prefixcmp(line, "    ")) {
-				int i;
-
 				if (!commit)
 					continue;
 
-				for (i = 0; i < commit->canvas.size; i++) {
-					struct graph_symbol *symbol = &commit->canvas.symbols[i];
-					const char *chars = graph_fn(symbol);
-
-					printf("%s", chars + (i == 0));
-				}
+				print_canvas(&commit->canvas, graph_fn);
 				printf("%s\n", line + 3);
 
 				commit = NULL;
@@ -96,4 +106,202 @@ main(int argc, const char *argv[])
 	return 0;
 }
 
+/*
+ * Synthetic histories
+ *
+ * Each generator is called with the commit number counting down from the
+ * newest commit (count - 1) to the root (0) and fills in the parents of
+ * the commit so that commits are emitted in the order used by git-log.
+ */
+
+#define MAX_PARENTS	8
+
+typedef size_t (*generate_fn)(size_t n, size_t width, size_t parents[]);
+
+static size_t
+generate_linear(size_t n, size_t width, size_t parents[])
+{
+	if (n == 0)
+		return 0;
+	parents[0] = n - 1;
+	return 1;
+}
+
+/* Blocks of MAX_PARENTS - 1 branch commits merged by an octopus. */
+static size_t
+generate_octopus(size_t n, size_t width, size_t parents[])
+{
+	size_t i;
+
+	if (n == 0)
+		return 0;
+
+	if (n % MAX_PARENTS) {
+		parents[0] = n / MAX_PARENTS * MAX_PARENTS;
+		return 1;
+	}
+
+	parents[0] = n - MAX_PARENTS;
+	for (i = 1; i < MAX_PARENTS; i++)
+		parents[i] = n - MAX_PARENTS + i;
+	return MAX_PARENTS;
+}
+
+/* Many branches growing side by side from the root. */
+static size_t
+generate_parallel(size_t n, size_t width, size_t parents[])
+{
+	if (n == 0)
+		return 0;
+	parents[0] = n > width ? n - width : 0;
+	return 1;
+}
+
+/* Two branches repeatedly merging each other. */
+static size_t
+generate_criss_cross(size_t n, size_t width, size_t parents[])
+{
+	if (n == 0)
+		return 0;
+	if (n < 3) {
+		parents[0] = 0;
+		return 1;
+	}
+
+	/* Odd commits are on one branch and even commits on the other. */
+	parents[0] = n - 2;
+	parents[1] = n % 2 ? n - 1 : n - 3;
+	return 2;
+}
+
+static const struct {
+	const char *name;
+	generate_fn fn;
+} generators[] = {
+	{ "linear",		generate_linear },
+	{ "octopus",		generate_octopus },
+	{ "parallel",		generate_parallel },
+	{ "criss-cross",	generate_criss_cross },
+};
+
+static generate_fn
+get_generator(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(generators); i++)
+		if (!strcmp(generators[i].name, name))
+			return generators[i].fn;
+
+	die("Unknown generator: %s", name);
+}
+
+static void
+format_commit_id(char *id, size_t n)
+{
+	snprintf(id, SIZEOF_REV, "%040zx", n);
+}
+
+static int
+generate_commits(struct graph *graph, graph_symbol_fn graph_fn, const char *name,
+		 size_t count, size_t width, bool bench)
+{
+	generate_fn generate = get_generator(name);
+	size_t symbols = 0, max_size = 0;
+	struct rusage usage;
+	clock_t start = clock();
+	double secs;
+	size_t n;
+
+	for (n = count; n > 0; n--) {
+		char id[SIZEOF_REV];
+		char ids[SIZEOF_REV * (MAX_PARENTS + 1)];
+		size_t parents[MAX_PARENTS];
+		size_t nparents = generate(n - 1, width, parents);
+		struct graph_canvas canvas = {};
+		size_t i;
+
+		format_commit_id(id, n - 1);
+		format_commit_id(ids, n - 1);
+		for (i = 0; i < nparents; i++) {
+			char *pos = ids + i * SIZEOF_REV;
+
+			pos[SIZEOF_REV - 1] = ' ';
+			format_commit_id(pos + SIZEOF_REV, parents[i]);
+		}
+
+		if (!graph_add_commit(graph, &canvas, id, ids, FALSE) ||
+		    !graph_render_parents(graph))
+			die("Failed to render commit %zu", n - 1);
+
+		symbols += canvas.size;
+		if (canvas.size > max_size)
+			max_size = canvas.size;
+
+		if (!bench) {
+			print_canvas(&canvas, graph_fn);
+			printf(" %zu\n", n - 1);
+		}
+
+		free(canvas.symbols);
+	}
+
+	if (!bench)
+		return 0;
+
+	secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+	getrusage(RUSAGE_SELF, &usage);
+
+	printf("generator:       %s\n", name);
+	printf("commits:         %zu\n", count);
+	printf("time:            %.3f secs (%.3f secs per 100k commits)\n",
+	       secs, count ? secs * 100000 / count : 0);
+	printf("canvas symbols:  %zu (%.1f per commit, max %zu)\n",
+	       symbols, count ? (double) symbols / count : 0, max_size);
+	printf("canvas memory:   %zu bytes\n", symbols * sizeof(struct graph_symbol));
+	printf("graph columns:   %zu\n", graph->row.size);
+	printf("max RSS:         %ld KB\n", usage.ru_maxrss);
+
+	return 0;
+}
+
+int
+main(int argc, const char *argv[])
+{
+	struct graph graph = { };
+	graph_symbol_fn graph_fn = graph_symbol_to_utf8;
+	const char *generator = NULL;
+	size_t count = 100;
+	size_t width = 16;
+	bool bench = FALSE;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (!strcmp(arg, "--ascii"))
+			graph_fn = graph_symbol_to_ascii;
+		else if (!strcmp(arg, "--bench"))
+			bench = TRUE;
+		else if (!prefixcmp(arg, "--generate="))
+			generator = arg + STRING_SIZE("--generate=");
+		else if (!prefixcmp(arg, "--count="))
+			count = atol(arg + STRING_SIZE("--count="));
+		else if (!prefixcmp(arg, "--width="))
+			width = atol(arg + STRING_SIZE("--width="));
+		else if (!prefixcmp(arg, "--max-width="))
+			graph.max_width = atol(arg + STRING_SIZE("--max-width="));
+		else
+			die(USAGE);
+	}
+
+	if (generator)
+		return generate_commits(&graph, graph_fn, generator, count, width ? width : 1, bench);
+
+	if (bench)
+		die(USAGE);
+
+	return read_commits(&graph, graph_fn);
+}
+
 /* vim: set ts=8 sw=8 noexpandtab: */